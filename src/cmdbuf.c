@@ -19,10 +19,12 @@
  */
 
 #include <conio.h>
+#include <ctype.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <dir.h>
+#include <sys/stat.h>
 #include "cmdbuf.h"
 
 #ifdef __MINGW32__
@@ -36,11 +38,276 @@
 static unsigned int tail = 0;
 static unsigned int cur = 0;
 
-#define MAX_CMDQUEUE_LEN 0x10
-static char cmdqueue[MAX_CMDQUEUE_LEN][MAX_CMD_BUFLEN];
-static unsigned int cmdqueue_count = 0;
-static unsigned int cmdqueue_index = 0;
+/* History is a ring of entries whose text lives in a circular arena.
+ * Storing evicts the oldest entries when either runs out, and a hash
+ * set finds an earlier copy of the same command, which is then only
+ * marked dead so that the ring never has to be compacted. The live
+ * entries are also linked in a list, so that recall never has to step
+ * over the dead ones. */
+#define HIST_MAX 4096            // entries, power of 2
+#define HIST_ARENA 0x10000       // bytes of command text
+#define HIST_HASH (HIST_MAX * 2) // hash set slots, power of 2
+#define HIST_NONE HIST_MAX       // end of the live list
+
+struct hist_ent {
+  unsigned off;
+  unsigned hash;
+  unsigned chars;                // see hist_chars()
+  int live;
+  unsigned short prev, next;     // live neighbours, as ring slots
+};
+
+static char hist_arena[HIST_ARENA];
+static struct hist_ent hist[HIST_MAX];
+/* 1-based ring slots, 0 is empty */
+static unsigned short hist_set[HIST_HASH];
+/* entry ids, the ring slot is id % HIST_MAX */
+static unsigned hist_first, hist_end, hist_pos;
+static unsigned hist_live;
+static unsigned hist_head;
+/* ring slots of the oldest and the newest live entry */
+static unsigned short hist_old = HIST_NONE, hist_new = HIST_NONE;
+/* the line being typed, while browsing the history */
+static char hist_tmp[MAX_CMD_BUFLEN];
+
 static const char *hist_name = "cc.his";
+static char hist_path[MAXPATH];
+static time_t hist_mtime;
+static off_t hist_size;
+
+#define HIST_SLOT(id) ((id) & (HIST_MAX - 1))
+#define HIST_STR(id) (hist_arena + hist[HIST_SLOT(id)].off)
+#define HIST_ID(slot) (hist_first + (((slot) - hist_first) & (HIST_MAX - 1)))
+
+static unsigned hist_hash_str(const char *s)
+{
+  unsigned h = 2166136261u;
+
+  while (*s)
+    {
+    h ^= (unsigned char)*s++;
+    h *= 16777619u;
+    }
+  return h;
+}
+
+/* A bit per character class present in s, ignoring case. Searches
+ * skip the entries that lack some of the bits of the string sought,
+ * without looking at their text. */
+static unsigned hist_chars(const char *s)
+{
+  unsigned m = 0;
+
+  while (*s)
+    m |= 1u << (tolower((unsigned char)*s++) & 31);
+  return m;
+}
+
+/* Returns the hash set position holding the entry, or of the empty
+ * slot where it would go. */
+static unsigned hist_set_find(const char *s, unsigned hash)
+{
+  unsigned i = hash & (HIST_HASH - 1);
+
+  while (hist_set[i])
+    {
+    struct hist_ent *e = &hist[hist_set[i] - 1];
+
+    if (e->hash == hash && strcmp(hist_arena + e->off, s) == 0)
+      break;
+    i = (i + 1) & (HIST_HASH - 1);
+    }
+  return i;
+}
+
+/* Remove by shifting back the following entries of the probe run,
+ * so that lookups never need tombstones. */
+static void hist_set_del(unsigned i)
+{
+  unsigned j = i;
+
+  hist_set[i] = 0;
+  for (;;)
+    {
+    unsigned k;
+
+    j = (j + 1) & (HIST_HASH - 1);
+    if (!hist_set[j])
+      break;
+    k = hist[hist_set[j] - 1].hash & (HIST_HASH - 1);
+    /* leave it if its home slot is cyclically in (i, j] */
+    if (i <= j ? (i < k && k <= j) : (i < k || k <= j))
+      continue;
+    hist_set[i] = hist_set[j];
+    hist_set[j] = 0;
+    i = j;
+    }
+}
+
+static void hist_kill(unsigned id)
+{
+  struct hist_ent *e = &hist[HIST_SLOT(id)];
+
+  if (!e->live)
+    return;
+  hist_set_del(hist_set_find(hist_arena + e->off, e->hash));
+  if (e->prev != HIST_NONE)
+    hist[e->prev].next = e->next;
+  else
+    hist_old = e->next;
+  if (e->next != HIST_NONE)
+    hist[e->next].prev = e->prev;
+  else
+    hist_new = e->prev;
+  e->live = 0;
+  hist_live--;
+}
+
+static void hist_evict(void)
+{
+  hist_kill(hist_first);
+  hist_first++;
+}
+
+/* Get need bytes at the arena head, wrapping to the start if the end
+ * is too short, and evict the oldest entries that are in the way. */
+static unsigned hist_alloc(unsigned need)
+{
+  unsigned off;
+
+  if (hist_end - hist_first == HIST_MAX)
+    hist_evict();
+  for (;;)
+    {
+    unsigned first_off;
+
+    if (hist_first == hist_end)
+      {
+      hist_head = 0;
+      break;
+      }
+    first_off = hist[HIST_SLOT(hist_first)].off;
+    if (first_off < hist_head)
+      {
+      if (hist_head + need <= HIST_ARENA)
+        break;
+      if (need <= first_off)
+        {
+        hist_head = 0;
+        break;
+        }
+      }
+    else if (hist_head + need <= first_off)
+      break;
+    hist_evict();
+    }
+  off = hist_head;
+  hist_head += need;
+  return off;
+}
+
+/* Append cmd as the newest entry, dropping an older copy of it. */
+static void hist_add(const char *cmd)
+{
+  unsigned len = strlen(cmd) + 1;
+  unsigned hash = hist_hash_str(cmd);
+  unsigned i = hist_set_find(cmd, hash);
+  struct hist_ent *e;
+
+  if (hist_set[i])
+    {
+    if (hist_set[i] - 1 == HIST_SLOT(hist_end - 1))
+      return;
+    hist_kill(HIST_ID(hist_set[i] - 1));
+    }
+  e = &hist[HIST_SLOT(hist_end)];
+  e->off = hist_alloc(len);
+  e->hash = hash;
+  e->chars = hist_chars(cmd);
+  e->live = 1;
+  /* link it after the evictions, which may have emptied the list */
+  e->prev = hist_new;
+  e->next = HIST_NONE;
+  if (hist_new != HIST_NONE)
+    hist[hist_new].next = HIST_SLOT(hist_end);
+  else
+    hist_old = HIST_SLOT(hist_end);
+  hist_new = HIST_SLOT(hist_end);
+  memcpy(hist_arena + e->off, cmd, len);
+  /* evictions may have moved the probe run */
+  hist_set[hist_set_find(cmd, hash)] = HIST_SLOT(hist_end) + 1;
+  hist_end++;
+  hist_live++;
+}
+
+static void hist_clear(void)
+{
+  memset(hist_set, 0, sizeof(hist_set));
+  hist_first = hist_end = hist_pos = 0;
+  hist_live = 0;
+  hist_head = 0;
+  hist_old = hist_new = HIST_NONE;
+  hist_tmp[0] = '\0';
+}
+
+/* Browsing with Up/Down only shows the entries that start with what
+ * was typed before it began. */
+static int hist_usable(unsigned slot)
+{
+  const struct hist_ent *e = &hist[slot];
+  size_t len = strlen(hist_tmp);
+
+  if (!len)
+    return 1;
+  return ((e->chars & hist_chars(hist_tmp)) == hist_chars(hist_tmp) &&
+      strncasecmp(hist_arena + e->off, hist_tmp, len) == 0);
+}
+
+/* Nearest usable entry before pos, or pos if there is none. */
+static unsigned hist_prev(unsigned pos)
+{
+  unsigned slot = (pos == hist_end ? hist_new : hist[HIST_SLOT(pos)].prev);
+
+  for (; slot != HIST_NONE; slot = hist[slot].prev)
+    {
+    if (hist_usable(slot))
+      return HIST_ID(slot);
+    }
+  return pos;
+}
+
+static unsigned hist_next_from(unsigned slot)
+{
+  for (; slot != HIST_NONE; slot = hist[slot].next)
+    {
+    if (hist_usable(slot))
+      return HIST_ID(slot);
+    }
+  return hist_end;
+}
+
+/* Nearest usable entry after pos, or hist_end for the typed line. */
+static unsigned hist_next(unsigned pos)
+{
+  if (pos == hist_end)
+    return pos;
+  return hist_next_from(hist[HIST_SLOT(pos)].next);
+}
+
+static int str_has(const char *s, const char *str, size_t len)
+{
+  for (; *s; s++)
+    {
+    if (strncasecmp(s, str, len) == 0)
+      return 1;
+    }
+  return 0;
+}
+
+static const char *hist_get(unsigned pos)
+{
+  return (pos == hist_end ? hist_tmp : HIST_STR(pos));
+}
 
 static void _cmdbuf_clr_line(char *cmd_buf)
 {
@@ -59,9 +326,9 @@ int cmdbuf_move(char *cmd_buf, int direction)
   switch (direction)
   {
     case UP:
-      if (cmdqueue_index && cmdqueue[cmdqueue_index - 1][0] != '\0')
+      if (hist_prev(hist_pos) != hist_pos)
         {
-        cmdqueue_index--;
+        hist_pos = hist_prev(hist_pos);
         ret++;
         }
       break;
@@ -80,10 +347,9 @@ int cmdbuf_move(char *cmd_buf, int direction)
       }
       break;
     case DOWN:
-      if (cmdqueue[cmdqueue_index][0] == '\0' ||
-          cmdqueue_index == cmdqueue_count)
+      if (hist_pos == hist_end)
         break;
-      cmdqueue_index++;
+      hist_pos = hist_next(hist_pos);
       ret++;
       break;
     case HOME:
@@ -101,15 +367,15 @@ int cmdbuf_move(char *cmd_buf, int direction)
       }
       break;
     case PGUP:
-      if (cmdqueue_index && cmdqueue[0][0] != '\0') {
-        cmdqueue_index = 0;
+      if (hist_prev(hist_pos) != hist_pos) {
+        hist_pos = hist_next_from(hist_old);
         direction = UP;
         ret++;
       }
       break;
     case PGDN:
-      if (cmdqueue_index < cmdqueue_count) {
-        cmdqueue_index = cmdqueue_count;
+      if (hist_pos != hist_end) {
+        hist_pos = hist_end;
         direction = DOWN;
         ret++;
       }
@@ -118,11 +384,11 @@ int cmdbuf_move(char *cmd_buf, int direction)
 
   if (direction == UP || direction == DOWN) {
     _cmdbuf_clr_line(cmd_buf);
-    if (cmdqueue[cmdqueue_index][0] != '\0') {
-      /* Reinput the command from the queue */
-      cputs(cmdqueue[cmdqueue_index]);
-      strcpy(cmd_buf, cmdqueue[cmdqueue_index]);
-      cur = tail = strlen(cmdqueue[cmdqueue_index]);
+    if (hist_get(hist_pos)[0] != '\0') {
+      /* Reinput the command from the history */
+      cputs(hist_get(hist_pos));
+      strcpy(cmd_buf, hist_get(hist_pos));
+      cur = tail = strlen(cmd_buf);
     }
   }
 
@@ -210,7 +476,7 @@ char cmdbuf_putch(char *cmd_buf, unsigned int buf_size, char ch, unsigned short
 
 void cmdbuf_reset(void)
 {
-  cmdqueue_index = cmdqueue_count;
+  hist_pos = hist_end;
   cur = tail = 0;
 }
 
@@ -240,121 +506,135 @@ int cmdbuf_gettail(void)
   return tail;
 }
 
+/* Only the line being typed is kept, recalled entries stay as they are. */
 void cmdbuf_store_tmp(const char *cmd_buf)
 {
-  strcpy(cmdqueue[cmdqueue_index], cmd_buf);
+  if (hist_pos == hist_end)
+    strcpy(hist_tmp, cmd_buf);
+}
+
+static void hist_stat(void)
+{
+  struct stat st;
+
+  if (stat(hist_path, &st) == 0)
+    {
+    hist_mtime = st.st_mtime;
+    hist_size = st.st_size;
+    }
 }
 
 void cmdbuf_store(const char *cmd_buf)
 {
   if (cmd_buf[0] == '\0')
     return;
-  if (!cmdqueue_count || strcmp(cmd_buf, cmdqueue[cmdqueue_count - 1]) != 0)
+  hist_tmp[0] = '\0';
+  if (hist_end == hist_first || strcmp(cmd_buf, HIST_STR(hist_end - 1)) != 0)
     {
-    const char *tmp;
-    /* Enqueue the cmdbuf and save the current index */
-    strcpy(cmdqueue[cmdqueue_count], cmd_buf);
-    cmdqueue_count++;
-    if (cmdqueue_count == MAX_CMDQUEUE_LEN)
-      {
-      int i;
-      for (i = 1; i < cmdqueue_count; i++)
-        strcpy(cmdqueue[i - 1], cmdqueue[i]);
-      cmdqueue_count--;
-      cmdqueue[cmdqueue_count][0] = '\0';
-      }
-    tmp = getenv("TEMP");
-    if (tmp)
+    hist_add(cmd_buf);
+    if (hist_path[0])
       {
-      char pathbuf[MAXPATH];
-      FILE *his;
-      snprintf(pathbuf, MAXPATH, "%s\\%s", tmp, hist_name);
-      his = fopen(pathbuf, "a");
+      FILE *his = fopen(hist_path, "a");
       if (his)
         {
         fputs(cmd_buf, his);
         fputs("\n", his);  // actually puts \r\n
         fclose(his);
+        /* our own append needs no reload */
+        hist_stat();
         }
       }
     }
-  cmdqueue_index = cmdqueue_count;
+  hist_pos = hist_end;
 }
 
-static int count_lines(FILE *f)
+/* (Re)load the history file, unless it is the one already loaded and
+ * nobody changed it since. */
+void cmdbuf_init(void)
 {
-  int c;
-  int cnt = 0;
-  while ((c = fgetc(f)) != EOF)
+  const char *tmp = getenv("TEMP");
+  char pathbuf[MAXPATH];
+  char line[MAX_CMD_BUFLEN];
+  struct stat st;
+  FILE *his;
+  unsigned lines = 0;
+
+  if (!tmp)
+    return;
+  snprintf(pathbuf, MAXPATH, "%s\\%s", tmp, hist_name);
+  if (strcmp(pathbuf, hist_path) != 0)
     {
-    if (c == '\n')
-      cnt++;
+    hist_clear();
+    strcpy(hist_path, pathbuf);
+    hist_size = -1;
     }
-  rewind(f);
-  return cnt;
-}
-
-static int seek_to_line(FILE *f, int n)
-{
-  int c;
-  int cnt = 0;
-  if (!n)
-    return 0;
-  while ((c = fgetc(f)) != EOF)
+  if (stat(pathbuf, &st) != 0)
+    return;
+  if (st.st_mtime == hist_mtime && st.st_size == hist_size)
+    return;
+  his = fopen(pathbuf, "r");
+  if (!his)
+    return;
+  hist_clear();
+  while (fgets(line, sizeof(line), his))
     {
-    if (c == '\n')
-      cnt++;
-    if (cnt == n)
-      return 0;
+    line[strcspn(line, "\r\n")] = '\0';
+    if (line[0] == '\0')
+      continue;
+    hist_add(line);
+    lines++;
     }
-  rewind(f);
-  return -1;
-}
-
-void cmdbuf_init(void)
-{
-  const char *tmp = getenv("TEMP");
-  if (tmp)
+  fclose(his);
+  hist_pos = hist_end;
+  /* drop the duplicates and evicted entries from the file */
+  if (lines > hist_live)
     {
-    char pathbuf[MAXPATH];
-    FILE *his;
-    snprintf(pathbuf, MAXPATH, "%s\\%s", tmp, hist_name);
-    his = fopen(pathbuf, "r");
+    his = fopen(pathbuf, "w");
     if (his)
       {
-      int cnt = count_lines(his);
-      int cnt1 = cnt;
-      /* always leave 1 empty slot */
-      if (cnt > (MAX_CMDQUEUE_LEN - 1))
+      unsigned slot;
+      for (slot = hist_old; slot != HIST_NONE; slot = hist[slot].next)
         {
-        seek_to_line(his, cnt - (MAX_CMDQUEUE_LEN - 1));
-        cnt = (MAX_CMDQUEUE_LEN - 1);
-        }
-      for (cmdqueue_count = 0; cmdqueue_count < cnt; cmdqueue_count++)
-        {
-        char *got = fgets(cmdqueue[cmdqueue_count], MAX_CMD_BUFLEN, his);
-        if (!got)
-          break;
-        /* strip \n */
-        cmdqueue[cmdqueue_count][strlen(cmdqueue[cmdqueue_count]) - 1] = '\0';
+        fputs(hist_arena + hist[slot].off, his);
+        fputs("\n", his);  // actually puts \r\n
         }
       fclose(his);
-      cmdqueue_index = cmdqueue_count;
-      /* if history is too long, rewrite the file */
-      if (cnt1 > cnt)
-        {
-        his = fopen(pathbuf, "w");
-        if (his)
-          {
-          int i;
-          for (i = 0; i < cnt; i++)
-            {
-            fputs(cmdqueue[i], his);
-            fputs("\n", his);  // actually puts \r\n
-            }
-          fclose(his);
-          }
-        }
       }
     }
+  hist_stat();
+}
+
+void cmdbuf_search_reset(void)
+{
+  hist_pos = hist_end;
+  hist_tmp[0] = '\0';
+}
+
+/* Find the newest entry containing str, ignoring case, starting at the
+ * current one, or at the one before it if older is set. The match gets
+ * current, so that Up and Down go on from there. */
+const char *cmdbuf_search(const char *str, int older)
+{
+  unsigned chars = hist_chars(str);
+  size_t len = strlen(str);
+  unsigned slot;
+
+  if (hist_pos == hist_end)
+    slot = hist_new;
+  else if (older)
+    slot = hist[HIST_SLOT(hist_pos)].prev;
+  else
+    slot = HIST_SLOT(hist_pos);
+  for (; slot != HIST_NONE; slot = hist[slot].prev)
+    {
+    const struct hist_ent *e = &hist[slot];
+
+    if ((e->chars & chars) == chars &&
+        str_has(hist_arena + e->off, str, len))
+      {
+      hist_pos = HIST_ID(slot);
+      return hist_arena + e->off;
+      }
+    }
+  return NULL;
 }
@@ -23,5 +23,7 @@ void cmdbuf_reset(void);
 void cmdbuf_init(void);
 int cmdbuf_getcur(void);
 int cmdbuf_gettail(void);
+void cmdbuf_search_reset(void);
+const char *cmdbuf_search(const char *str, int older);
 
 #endif
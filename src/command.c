@@ -73,6 +73,7 @@
 #include <stdint.h>
 #include <sys/stat.h>
 #include <sys/statvfs.h>
+#include <sys/time.h>
 #include <stubinfo.h>
 #include <process.h>
 #include <sys/segments.h>
@@ -97,7 +98,10 @@
 #include "ae0x.h"
 #include "compl.h"
 #include "clip.h"
+#include "fcopy.h"
+#include "crc32.h"
 #include "command.h"
+#include "walk.h"
 
 /*
  * These declarations/definitions turn off some unwanted DJGPP features
@@ -284,10 +288,10 @@ struct built_in_cmd cmd_table[] =
     {"copy", perform_copy, "", "copy file"},
     {"ctty", perform_ctty, "", "change tty"},
     {"date", perform_date, "", "display date"},
-    {"del", perform_delete, "", "delete file"},
+    {"del", perform_delete, " [/q] [/s]", "delete file"},
     {"deltree", perform_deltree, "", "delete directory recursively"},
-    {"erase", perform_delete, "", "delete file"},
-    {"dir", perform_dir, "", "directory listing"},
+    {"erase", perform_delete, " [/q] [/s]", "delete file"},
+    {"dir", perform_dir, " [/w] [/p] [/o]", "directory listing"},
     {"djterm", perform_djterm, "", "terminal driver"},
     {"echo.", perform_echo_dot, "", "terminal output"},  // before normal echo
     {"echo", perform_echo, "", "terminal output"},
@@ -625,7 +629,10 @@ NoArgs:
 
 static unsigned short keyb_get_rawcode(void)
 {
-  unsigned short c = getch();
+  unsigned short c;
+
+  fflush(stdout);
+  c = getch();
 
   if (c == 0x00/* || c == 0xE0*/)
     c = getch()<<8;
@@ -634,7 +641,10 @@ static unsigned short keyb_get_rawcode(void)
 
 static unsigned short keyb_get_rawcode_e(void)
 {
-  unsigned short c = getche();
+  unsigned short c;
+
+  fflush(stdout);
+  c = getche();
 
   if (c == 0x00/* || c == 0xE0*/)
     c = getche()<<8;
@@ -646,11 +656,80 @@ unsigned short keyb_get_shift_states(void)
   return bioskey(2);
 }
 
+/* Ctrl-R: search the history backwards as the string gets typed, and
+ * Ctrl-R again for an older match. Esc or ^C bring the line back, any
+ * other key leaves the match in the line and is returned to be handled
+ * there, so that Enter runs it and the arrows start editing it. */
+static int reverse_search(char *conbuf)
+  {
+  char str[MAX_CMD_BUFLEN] = "";
+  char saved[MAX_CMD_BUFLEN+1];
+  const char *match = "";
+  int len = 0, key, older = 0, failed = 0;
+
+  cmdbuf_trunc(conbuf);
+  strcpy(saved, conbuf);
+  cmdbuf_search_reset();
+  for (;;)
+    {
+    if (len)
+      {
+      const char *m = cmdbuf_search(str, older);
+      if (m)
+        match = m;
+      failed = !m;
+      }
+    older = 0;
+    putch('\r');
+    clreol();
+    cprintf("(%sreverse-i-search)`%s': %s", failed ? "failed " : "", str,
+        match);
+    key = keyb_get_rawcode();
+    if (KEY_ASCII(key) != 0)
+      key = KEY_ASCII(key);
+    if (key == KEY_CTRL_R)
+      older = 1;
+    else if (key == KEY_BACKSPACE)
+      {
+      /* a shorter string may match something newer */
+      if (len)
+        str[--len] = '\0';
+      cmdbuf_search_reset();
+      match = "";
+      failed = 0;
+      }
+    else if (key >= ' ' && key <= 0xff)
+      {
+      if (len < sizeof(str) - 1)
+        {
+        str[len++] = key;
+        str[len] = '\0';
+        }
+      }
+    else
+      break;
+    }
+
+  putch('\r');
+  clreol();
+  output_prompt();
+  if (key == KEY_ESC || key == 3 || key == 0x100)
+    {
+    cmdbuf_search_reset();
+    key = 0;
+    }
+  strcpy(conbuf, key && match[0] ? match : saved);
+  cputs(conbuf);
+  cmdbuf_puts(conbuf);
+  return key;
+  }
+
 static void prompt_for_and_get_cmd(void)
   {
-  int flag = 0, key = 0, len, len1, need_store, got_tab;
+  int flag = 0, key = 0, len, len1, need_store, got_tab, next_key = 0;
   char conbuf[MAX_CMD_BUFLEN+1];
 
+  compl_invalidate();
   output_prompt();
   /* Console initialize */
   flag = keyb_get_shift_states();
@@ -663,8 +742,14 @@ static void prompt_for_and_get_cmd(void)
   got_tab = 0;
   conbuf[0] = '\0';
   do {
-    /* Wait and get raw key code */
-    key = keyb_get_rawcode();
+    /* Wait and get raw key code, unless one ended a history search */
+    if (next_key)
+      {
+      key = next_key;
+      next_key = 0;
+      }
+    else
+      key = keyb_get_rawcode();
     flag = keyb_get_shift_states();
 
 //    if (KEY_ASCII(key) == KEY_EXT)
@@ -711,12 +796,11 @@ static void prompt_for_and_get_cmd(void)
           _setcursortype(_SOLIDCURSOR);
         break;
       case KEY_UP:
+        /* also when empty, it is the prefix to browse for */
+        cmdbuf_trunc(conbuf);
+        cmdbuf_store_tmp(conbuf);
         if (conbuf[0])
-          {
-          cmdbuf_trunc(conbuf);
-          cmdbuf_store_tmp(conbuf);
           cmdbuf_clear(conbuf);
-          }
         cmdbuf_move(conbuf, UP);
         break;
       case KEY_LEFT:
@@ -726,35 +810,32 @@ static void prompt_for_and_get_cmd(void)
         cmdbuf_move(conbuf, RIGHT);
         break;
       case KEY_DOWN:
+        cmdbuf_trunc(conbuf);
+        cmdbuf_store_tmp(conbuf);
         if (conbuf[0])
-          {
-          cmdbuf_trunc(conbuf);
-          cmdbuf_store_tmp(conbuf);
           cmdbuf_clear(conbuf);
-          }
         cmdbuf_move(conbuf, DOWN);
         break;
       case KEY_PGUP:
+        cmdbuf_trunc(conbuf);
+        cmdbuf_store_tmp(conbuf);
         if (conbuf[0])
-          {
-          cmdbuf_trunc(conbuf);
-          cmdbuf_store_tmp(conbuf);
           cmdbuf_clear(conbuf);
-          }
         cmdbuf_move(conbuf, PGUP);
         break;
       case KEY_PGDN:
+        cmdbuf_trunc(conbuf);
+        cmdbuf_store_tmp(conbuf);
         if (conbuf[0])
-          {
-          cmdbuf_trunc(conbuf);
-          cmdbuf_store_tmp(conbuf);
           cmdbuf_clear(conbuf);
-          }
         cmdbuf_move(conbuf, PGDN);
         break;
       case KEY_HOME:
         cmdbuf_move(conbuf, HOME);
         break;
+      case KEY_CTRL_R:
+        next_key = reverse_search(conbuf);
+        break;
       case KEY_END:
         cmdbuf_move(conbuf, END);
         break;
@@ -775,22 +856,8 @@ static void prompt_for_and_get_cmd(void)
           p1 = conbuf;
         if (p1)
           {
+          /* dirs come back with their backslash and rc 0 */
           rc = compl_fname(p1, got_tab, &l, p);
-          /* fixup for directories */
-          if (rc == 1)
-            {
-            char buf[MAXPATH];
-            struct stat sb;
-            strcpy(buf, p1);
-            strcat(buf, p);
-            int err = stat(buf, &sb);
-            if (!err && (sb.st_mode & S_IFMT) == S_IFDIR)
-              {
-              strcat(p, "\\");
-              l++;
-              rc = 0;
-              }
-            }
           }
         else
           rc = compl_cmds(conbuf, got_tab, &l, p);
@@ -1113,13 +1180,73 @@ static int ensure_dir_existence(char *dir)
   return 0;
   }
 
+/* Length of the text before the first ^Z, ^C or NUL. */
+static size_t type_span(const char *buf, size_t len)
+  {
+  static const char stops[] = { 0x1a, 3, 0 };
+  const char *p;
+  int i;
+
+  for (i = 0; i < sizeof(stops); i++)
+    {
+    p = memchr(buf, stops[i], len);
+    if (p)
+      len = p - buf;
+    }
+  return len;
+  }
+
+static int dev_set_info(int fd, int dinfo)
+  {
+  __dpmi_regs r = {};
+
+  r.x.ax = 0x4401;
+  r.x.bx = fd;
+  r.x.dx = dinfo & 0xff;
+  __dpmi_int(0x21, &r);
+  return (r.x.flags & 1) ? -1 : 0;
+  }
+
+static int dev_input_ready(int fd)
+  {
+  __dpmi_regs r = {};
+
+  r.x.ax = 0x4406;
+  r.x.bx = fd;
+  __dpmi_int(0x21, &r);
+  return !(r.x.flags & 1) && r.h.al == 0xff;
+  }
+
+/* Read a block from a raw mode device. 4406h only tells that some
+ * input is pending, not how much, and a raw read waits for all the
+ * bytes asked for. So wait for one byte, then take more one by one
+ * while the device still has input, up to size or the terminator. */
+static int dev_read(int fd, char *buf, int size)
+  {
+  int len = 0;
+
+  while (len < size)
+    {
+    int rd = read(fd, buf + len, 1);
+    char c;
+
+    if (rd <= 0)
+      return len ? len : rd;
+    c = buf[len++];
+    if (c == 0x1a || c == 3 || c == 0)
+      break;
+    if (!dev_input_ready(fd))
+      break;
+    }
+  return len;
+  }
+
 static int copy_single_file(char *source_file, char *dest_file,
-    int transfer_type, int append)
+    int transfer_type, int append, uint32_t *crc)
   {
-  FILE *source_stream;
-  FILE *dest_stream;
-  char transfer_buffer[32768];
-  size_t byte_count;
+  char buf[4096];
+  int source_fd, dest_fd, dinfo, raw, len;
+  size_t n;
   struct stat st;
   int err;
 
@@ -1134,71 +1261,96 @@ static int copy_single_file(char *source_file, char *dest_file,
     cprintf("cannot stat %s\r\n", source_file);
     return -1;
     }
-  if (st.st_mode & S_IFCHR)
-    {
-    source_stream = fopen(source_file, "rt");
-    setbuf(source_stream, NULL);
-    __file_handle_set(fileno(source_stream), O_BINARY);
-    }
-  else
+  if (!(st.st_mode & S_IFCHR))
     {
-    /* Open file for copy */
-    source_stream = fopen(source_file, "rb");
+    /* Regular file: let fcopy move the data handle-to-handle */
+    source_fd = open(source_file, O_RDONLY | O_BINARY);
+    if (source_fd == -1)
+      {
+      cprintf("Unable to open source file - %s\r\n", source_file);
+      return -1;
+      }
+    dest_fd = open(dest_file, O_WRONLY | O_BINARY | O_CREAT |
+        (append ? 0 : O_TRUNC), S_IRUSR | S_IWUSR);
+    if (dest_fd == -1)
+      {
+      cprintf("Unable to open destination file - %s\r\n", dest_file);
+      close(source_fd);
+      return -1;
+      }
+    if (append && lseek(dest_fd, 0, SEEK_END) == -1)
+      goto copy_error_close_fd;
+    if (fcopy_fd(dest_fd, source_fd, st.st_size, crc) != 0)
+      goto copy_error_close_fd;
+    if (file_copytime(dest_fd, source_fd) != 0)
+      goto copy_error_close_fd;
+    close(source_fd);
+    if (close(dest_fd) != 0)
+      goto copy_error;
+    return 0;
     }
-  if (source_stream == NULL)
+
+  /* Device: read it in blocks, stop on ^Z/^C/NUL on our own */
+  source_fd = open(source_file, O_RDONLY | O_TEXT);
+  if (source_fd == -1)
     {
     cprintf("Unable to open source file - %s\r\n", source_file);
     return -1;
     }
-  dest_stream = fopen(dest_file, append ? "ab" : "wb");
-  if (dest_stream == NULL)
+  __file_handle_set(source_fd, O_BINARY);
+  dest_fd = open(dest_file, O_WRONLY | O_BINARY | O_CREAT |
+      (append ? 0 : O_TRUNC), S_IRUSR | S_IWUSR);
+  if (dest_fd == -1)
     {
     cprintf("Unable to open destination file - %s\r\n", dest_file);
-    fclose(source_stream);
+    close(source_fd);
     return -1;
     }
+  if (append && lseek(dest_fd, 0, SEEK_END) == -1)
+    goto copy_error_close_fd;
+  /* CON stays cooked, for echo and line editing */
+  dinfo = _get_dev_info(source_fd);
+  raw = (dinfo != -1 && !(dinfo & (_DEV_STDIN | _DEV_STDOUT)));
+  if (raw && !(dinfo & _DEV_RAW))
+    dev_set_info(source_fd, dinfo | _DEV_RAW);
 
-  /* Copy file contents*/
-  do
+  /* Copy device contents */
+  while ((len = (raw ? dev_read(source_fd, buf, sizeof(buf)) :
+      read(source_fd, buf, sizeof(buf)))) > 0)
     {
-    byte_count = 0;
-    if (st.st_mode & S_IFCHR)
-      {
-      int c;
-      c = fgetc(source_stream);
-      if (!(c == EOF || c == 0x1a || c == 3 || c == 0))
-        {
-        transfer_buffer[0] = c;
-        byte_count = 1;
-        }
-      }
-    else
-      byte_count = fread(transfer_buffer, 1, 32768, source_stream);
-    if (byte_count > 0)
+    n = type_span(buf, len);
+    if (crc)
+      *crc = crc32_update(*crc, buf, n);
+    if (n > 0 && write(dest_fd, buf, n) != n)
       {
-      if (fwrite(transfer_buffer, 1, byte_count, dest_stream) != byte_count)
-        goto copy_error_close;
+      len = -1;
+      break;
       }
+    if (n < len)
+      break;
     }
-  while (byte_count > 0);
+  if (raw && !(dinfo & _DEV_RAW))
+    dev_set_info(source_fd, dinfo);
+  if (len < 0)
+    goto copy_error_close_fd;
 
   /* Copy date and time */
-  fflush(dest_stream);
-  if (file_copytime (fileno(dest_stream), fileno(source_stream)) != 0)
-    goto copy_error_close;
+  if (file_copytime(dest_fd, source_fd) != 0)
+    goto copy_error_close_fd;
 
   /* Close source and dest files */
-  fclose(source_stream);
-  if (fclose(dest_stream) != 0)
+  close(source_fd);
+  if (close(dest_fd) != 0)
     goto copy_error;
   return 0;
 
 /*
 *    Error routine
 */
-copy_error_close:
-  fclose(source_stream);
-  fclose(dest_stream);
+copy_error_close_fd:
+  close(source_fd);
+  close(dest_fd);
+  goto copy_error;
 
 copy_error:
   remove(dest_file);          // erase the unfinished file
@@ -1209,66 +1361,41 @@ copy_error:
   return -1;
   }  /* copy_single_file */
 
-static int verify_file(char *master_file, char *verify_file)
+/* Re-read only the copy and compare it with the checksum of the data
+ * that was written to it. */
+static int verify_file(char *master_file, char *verify_file, uint32_t crc)
   {
-  FILE *mstream;
-  FILE *vstream;
-  char mtransfer_buffer[32768];
-  char vtransfer_buffer[32768];
-  int b;
-  size_t mbyte_count, vbyte_count;
+  int vfd;
+  uint32_t vcrc = 0;
   struct stat mfile_st, vfile_st;
 
-
-  /* Open files */
-  mstream = fopen(master_file, "rb");
-  if (mstream == NULL)
+  /* verify size, date and time */
+  if (stat(master_file, &mfile_st) != 0)
     goto verify_error;
-  vstream = fopen(verify_file, "rb");
-  if (vstream == NULL)
-    {
-    fclose(mstream);
+  if (stat(verify_file, &vfile_st) != 0)
+    goto verify_error;
+  if (mfile_st.st_size != vfile_st.st_size ||
+      mfile_st.st_atime != vfile_st.st_atime ||
+      mfile_st.st_mtime != vfile_st.st_mtime)
     goto verify_error;
-    }
 
-  /* Verify file contents*/
-  do
+  /* Verify file contents */
+  vfd = open(verify_file, O_RDONLY | O_BINARY);
+  if (vfd == -1)
+    goto verify_error;
+  if (fcopy_crc(vfd, &vcrc) != 0)
     {
-    mbyte_count = fread(mtransfer_buffer, 1, 32768, mstream);
-    vbyte_count = fread(vtransfer_buffer, 1, 32768, vstream);
-    if (mbyte_count != vbyte_count)
-      goto verify_error_close;
-    if (mbyte_count > 0)
-      {
-      for (b = 0; b < mbyte_count; b++)
-        {
-        if (mtransfer_buffer[b] != vtransfer_buffer[b])
-          goto verify_error_close;
-        }
-      }
+    close(vfd);
+    goto verify_error;
     }
-  while (mbyte_count > 0);
-
-  /* verify date and time */
-  if (fstat(fileno(mstream), &mfile_st) != 0)
-    goto verify_error_close;
-  if (fstat(fileno(vstream), &vfile_st) != 0)
-    goto verify_error_close;
-  if (mfile_st.st_atime != vfile_st.st_atime || mfile_st.st_mtime != vfile_st.st_mtime)
-    goto verify_error_close;
-
-  /* Close source and dest files */
-  fclose(mstream);
-  fclose(vstream);
+  close(vfd);
+  if (vcrc != crc)
+    goto verify_error;
   return 0;
 
 /*
 *    Error routine
 */
-verify_error_close:
-  fclose(mstream);
-  fclose(vstream);
-
 verify_error:
   cprintf("Verify failed - %s\r\n", verify_file);
   return -1;
@@ -1318,31 +1445,222 @@ static void expand_wildcard(char *spec, const char *fname, const char *fext)
     }
   }
 
+#define IS_CHRDEV(d) ((d) & _DEV_CDEV)
+
+#define PROGRESS_MIN_SIZE (1024L * 1024)
+
+static int progress_pct;
+
+/* Update the in-place percentage line while copying a large file. */
+static void show_copy_progress(unsigned long done, unsigned long size)
+  {
+  int pct;
+
+  if (size < PROGRESS_MIN_SIZE)
+    return;
+  pct = (unsigned long long)done * 100 / size;
+  if (pct > 100)
+    pct = 100;
+  if (pct == progress_pct)
+    return;
+  progress_pct = pct;
+  printf("\r%3d%%", pct);
+  fflush(stdout);
+  }
+
+static void print_xfer_stats(struct walk *w, int files,
+    unsigned long long bytes, struct timeval *start)
+  {
+  struct timeval now;
+  double secs;
+
+  gettimeofday(&now, NULL);
+  secs = (now.tv_sec - start->tv_sec) +
+      (now.tv_usec - start->tv_usec) / 1000000.0;
+  printf("%llu bytes in %.2f s", bytes, secs);
+  if (secs > 0)
+    printf(", %.2f MB/s, %.1f files/s",
+        bytes / secs / (1024 * 1024), files / secs);
+  printf("\n%lu dir(s) walked, %lu find calls\n", w->dirs, w->dos_calls);
+  }
+
+/* Parse m-d-y of XCOPY /D:date into yyyymmdd, -1 if invalid. */
+static long parse_switch_date(const char *arg)
+  {
+  unsigned int m, d, y;
+
+  if (sscanf(arg, "%u-%u-%u", &m, &d, &y) != 3 ||
+      m == 0 || m > 12 || d == 0 || d > 31)
+    return -1;
+  if (y < 80)
+    y += 2000;
+  else if (y < 100)
+    y += 1900;
+  else if (y < 1980)
+    return -1;
+  return y * 10000L + m * 100 + d;
+  }
+
+/* XCOPY /D: see if the file was written on or after since (yyyymmdd),
+ * or without a date, if it differs from the destination copy by size
+ * or is newer than it. */
+static int is_file_newer(finddata_t *ff, const char *dest_file, long since)
+  {
+  finddata_t dff;
+  long h;
+  int newer;
+
+  if (since)
+    return (FINDDATA_T_WDATE_YEAR((*ff))) * 10000L +
+        (FINDDATA_T_WDATE_MON((*ff))) * 100 +
+        (FINDDATA_T_WDATE_DAY((*ff))) >= since;
+
+  if (findfirst_f(dest_file, &dff, FA_HIDDEN+FA_SYSTEM, &h) != 0)
+    return true;
+  newer = FINDDATA_T_SIZE((*ff)) != FINDDATA_T_SIZE(dff) ||
+      FINDDATA_T_WSTAMP((*ff)) > FINDDATA_T_WSTAMP(dff);
+  findclose_f(h);
+  return newer;
+  }
+
+struct xfer_ctx
+  {
+  int transfer_type;
+  int append;
+  int do_file_verify;
+  int copy_empty_subdirs;
+  int only_newer;
+  long since_date;
+  int clear_archive;
+  int same_drive;
+  const char *dest_filespec;
+  char dest_dir[MAXPATH];   // destination of the dir being walked
+  size_t dst_len;
+  int dst_exists;           // dest_dir already made sure to exist
+  int xfer_count;
+  int skip_count;
+  unsigned long long xfer_bytes;
+  };
+
+static int xfer_dir_pre(struct walk *w, const char *name)
+  {
+  struct xfer_ctx *x = w->arg;
+  size_t len = x->dst_len + strlen(name) + 1;
+
+  if (set_path_tail(x->dest_dir, x->dst_len, name) != 0 ||
+      set_path_tail(x->dest_dir, len - 1, "\\") != 0)
+    {
+    cprintf("Path too long - %s\r\n", w->path);
+    return -1;
+    }
+  if (x->copy_empty_subdirs && ensure_dir_existence(x->dest_dir) != 0)
+    return -1;
+  x->dst_len = len;
+  x->dst_exists = x->copy_empty_subdirs;
+  return 0;
+  }
+
+static int xfer_dir_post(struct walk *w, const char *name)
+  {
+  struct xfer_ctx *x = w->arg;
+
+  x->dst_len -= strlen(name) + 1;
+  x->dest_dir[x->dst_len] = '\0';
+  return 0;
+  }
+
+static int xfer_file(struct walk *w, finddata_t *ff)
+  {
+  struct xfer_ctx *x = w->arg;
+  char *source_file = w->path;
+  const char *name = w->path + w->len;
+  char dest_file[MAXPATH];
+  uint32_t crc = 0;
+  int rc;
+
+  memcpy(dest_file, x->dest_dir, x->dst_len);
+  if (set_path_tail(dest_file, x->dst_len,
+      strcmp(x->dest_filespec, "*.*") == 0 ? name : x->dest_filespec) != 0)
+    {
+    cprintf("Path too long - %s\r\n", x->dest_dir);
+    return -1;
+    }
+  if (x->only_newer && !is_file_newer(ff, dest_file, x->since_date))
+    {
+    x->skip_count++;
+    return 0;
+    }
+  if ((x->transfer_type == FILE_XFER_XCOPY ||
+      x->transfer_type == FILE_XFER_MOVE) && !x->dst_exists)
+    {
+    // all files of a dir go to the same directory
+    if (ensure_dir_existence(x->dest_dir) != 0)
+      return -1;
+    x->dst_exists = true;
+    }
+  // on the same drive a move is just a directory entry update,
+  // copy only if that is not possible
+  if (!x->same_drive || rename(source_file, dest_file) != 0)
+    {
+    progress_pct = -1;
+    rc = copy_single_file(source_file, dest_file, x->transfer_type,
+                          x->append, x->do_file_verify ? &crc : NULL);
+    if (progress_pct != -1)
+      printf("\r     \r");     // wipe the progress line
+    if (rc != 0)
+      return -1;
+    if (x->do_file_verify)
+      {
+      if (verify_file(source_file, dest_file, crc) != 0)
+        return -1;
+      }
+    if (x->transfer_type == FILE_XFER_MOVE)
+      {
+      if (remove(source_file) != 0)
+        {
+        remove(dest_file);
+        cprintf("Unable to move file - %s\r\n", source_file);
+        return -1;
+        }
+      }
+    }
+  if (x->clear_archive)
+    {
+    if (setfileattr(source_file, FINDDATA_T_ATTRIB((*ff)) & ~FA_ARCH) != 0)
+      {
+      cprintf("Cannot set attribute - %s\r\n", source_file);
+      return -1;
+      }
+    }
+  printf("%s %s to %s\n",
+    name,
+    x->append ? "appended" : (
+    x->transfer_type == FILE_XFER_MOVE?"moved":"copied"),
+    strcmp(x->dest_filespec, "*.*")==0?x->dest_dir:dest_file);
+  x->xfer_count++;
+  x->xfer_bytes += FINDDATA_T_SIZE((*ff));
+  return 0;
+  }
+
 static void general_file_transfer(int transfer_type, int append)
   {
-  int xfer_count = 0;
-  int ffrc;
-  long ffhandle = 0;
+  struct xfer_ctx x = { 0 };
+  struct walk w;
+  int rc;
   int traverse_subdirs = false;
   int copy_empty_subdirs = false;
+  int only_newer = false;
+  long since_date = 0;
+  int archive_only = false;
+  int clear_archive = false;
+  int show_stats = false;
+  struct timeval start_tv;
   int do_file_verify;
-  int s, subdir_level = 0;
-  finddata_t ff[MAX_SUBDIR_LEVEL];
-  char dir_name[MAX_SUBDIR_LEVEL][MAXPATH];
-  int visitation_mode[MAX_SUBDIR_LEVEL]; // 4 = findfirst source_filespec for files;
-                                         // 3 = findnext source_filespec for files;
-                                         // 2 = findfirst *.* for subdirs;
-                                         // 1 = findnext *.* for subdirs;
-                                         // 0 = done
-  unsigned attrib;
   char drivespec[MAXDRIVE], dirspec[MAXDIR], s_filespec[MAXFILE], s_extspec[MAXEXT];
   char d_filespec[MAXFILE], d_extspec[MAXEXT];
   char temp_path[MAXPATH];
   char source_path[MAXPATH] = "", source_filespec[MAXPATH];
   char dest_path[MAXPATH] = "", dest_filespec[MAXPATH];
-  char full_source_filespec[MAXPATH];
-  char full_dest_filespec[MAXPATH];
-  char full_dest_dirspec[MAXPATH];
 
   if (transfer_type == FILE_XFER_MOVE)
     do_file_verify = true;
@@ -1382,10 +1700,12 @@ static void general_file_transfer(int transfer_type, int append)
         else
           goto InvalidSwitch;
         }
-      if (stricmp(cmd_switch,"/b") == 0)
+      else if (stricmp(cmd_switch,"/b") == 0)
         {
         /* ignore */
         }
+      else if (stricmp(cmd_switch,"/stats") == 0)
+        show_stats = true;
       else
         {
         if (transfer_type == FILE_XFER_XCOPY)
@@ -1394,6 +1714,26 @@ static void general_file_transfer(int transfer_type, int append)
             traverse_subdirs = true;
           else if (stricmp(cmd_switch,"/e") == 0)
             copy_empty_subdirs = true;
+          else if (stricmp(cmd_switch,"/d") == 0)
+            only_newer = true;
+          else if (stricmp(cmd_switch,"/a") == 0)
+            archive_only = true;
+          else if (stricmp(cmd_switch,"/m") == 0)
+            {
+            archive_only = true;
+            clear_archive = true;
+            }
+          else if (strnicmp(cmd_switch,"/d:",3) == 0)
+            {
+            since_date = parse_switch_date(cmd_switch+3);
+            if (since_date == -1)
+              {
+              cprintf("Invalid date - %s\r\n", cmd_switch+3);
+              reset_batfile_call_stack();
+              return;
+              }
+            only_newer = true;
+            }
           else
             goto InvalidSwitch;
           }
@@ -1530,142 +1870,69 @@ static void general_file_transfer(int transfer_type, int append)
       }
     }
 
-  // visit each directory; perform transfer
-  visitation_mode[0] = 4;
-  dir_name[0][0] = '\0';
-  while (subdir_level >= 0)
+  x.transfer_type = transfer_type;
+  x.append = append;
+  x.do_file_verify = do_file_verify;
+  x.copy_empty_subdirs = copy_empty_subdirs;
+  x.only_newer = only_newer;
+  x.since_date = since_date;
+  x.clear_archive = clear_archive;
+  x.same_drive = (transfer_type == FILE_XFER_MOVE &&
+      toupper(source_path[0]) == toupper(dest_path[0]));
+  x.dest_filespec = dest_filespec;
+  strcpy(x.dest_dir, dest_path);
+  x.dst_len = strlen(dest_path);
+
+  walk_init(&w, source_filespec);
+  w.recurse = traverse_subdirs;
+  w.attrib = FA_HIDDEN+FA_SYSTEM;
+  if (archive_only)
     {
-    if (visitation_mode[subdir_level] == 4 || visitation_mode[subdir_level] == 2)
-      {
-      strcpy(full_source_filespec, source_path);
-      for (s = 0; s <= subdir_level; s++)
-        strcat(full_source_filespec, dir_name[s]);
-      if (visitation_mode[subdir_level] == 4)
-        {
-        strcat(full_source_filespec, source_filespec);
-        attrib = 0+FA_HIDDEN+FA_SYSTEM;
-        }
-      else
-        {
-        strcat(full_source_filespec, "*.*");
-        attrib = 0+FA_DIREC+FA_HIDDEN+FA_SYSTEM;
-        }
-      ffrc = findfirst_f(full_source_filespec, &(ff[subdir_level]), attrib, &ffhandle);
-      visitation_mode[subdir_level]--;
-      }
-    else
-      ffrc = findnext_f(&(ff[subdir_level]), ffhandle);
-    if (ffrc == 0)
-      {
-      conv_unix_path_to_ms_dos(FINDDATA_T_FILENAME(ff[subdir_level]));
-      strcpy(full_source_filespec, source_path);
-      strcpy(full_dest_filespec, dest_path);
-      strcpy(full_dest_dirspec, dest_path);
-      for (s = 0; s <= subdir_level; s++)
-        {
-        strcat(full_source_filespec, dir_name[s]);
-        strcat(full_dest_filespec, dir_name[s]);
-        strcat(full_dest_dirspec, dir_name[s]);
-        }
-      strcat(full_source_filespec, FINDDATA_T_FILENAME(ff[subdir_level]));
-      if (strcmp(dest_filespec, "*.*") == 0)
-        strcat(full_dest_filespec, FINDDATA_T_FILENAME(ff[subdir_level]));
-      else
-        strcat(full_dest_filespec, dest_filespec);
+    w.attr_mask = FA_ARCH;
+    w.attr_val = FA_ARCH;
+    }
+  w.file = xfer_file;
+  w.dir_pre = xfer_dir_pre;
+  w.dir_post = xfer_dir_post;
+  w.arg = &x;
 
-      if ((FINDDATA_T_ATTRIB(ff[subdir_level])&FA_DIREC) != 0)
-        {
-        if (visitation_mode[subdir_level] <= 2 &&
-            traverse_subdirs &&
-            strcmp(FINDDATA_T_FILENAME(ff[subdir_level]),".") != 0 &&
-            strcmp(FINDDATA_T_FILENAME(ff[subdir_level]),"..") != 0)
-          {
-          subdir_level++;
-          if (subdir_level >= MAX_SUBDIR_LEVEL)
-            {
-            cputs("Directory tree is too deep\r\n");
-            reset_batfile_call_stack();
-            goto ExitOperation;
-            }
-          if (copy_empty_subdirs)
-            {
-            if (ensure_dir_existence(full_dest_filespec) != 0)
-              {
-              reset_batfile_call_stack();
-              goto ExitOperation;
-              }
-            }
-          visitation_mode[subdir_level] = 4;
-          strcpy(dir_name[subdir_level], FINDDATA_T_FILENAME(ff[subdir_level-1]));
-          strcat(dir_name[subdir_level], "\\");
-          }
-        }
-      else
-        {
-        if (visitation_mode[subdir_level] > 2)
-          {
-          if (transfer_type == FILE_XFER_XCOPY ||
-              transfer_type == FILE_XFER_MOVE)
-            {
-            if (ensure_dir_existence(full_dest_dirspec) != 0)
-              {
-              reset_batfile_call_stack();
-              goto ExitOperation;
-              }
-            }
-          if (copy_single_file(full_source_filespec,
-                               full_dest_filespec, transfer_type, append) != 0)
-            {
-            reset_batfile_call_stack();
-            goto ExitOperation;
-            }
-          if (do_file_verify)
-            {
-            if (verify_file(full_source_filespec, full_dest_filespec) != 0)
-              {
-              reset_batfile_call_stack();
-              goto ExitOperation;
-              }
-            }
-          if (transfer_type == FILE_XFER_MOVE)
-            {
-            if (remove(full_source_filespec) != 0)
-              {
-              remove(full_dest_filespec);
-              cprintf("Unable to move file - %s\r\n", full_source_filespec);
-              reset_batfile_call_stack();
-              goto ExitOperation;
-              }
-            }
-          printf("%s %s to %s\n",
-            FINDDATA_T_FILENAME(ff[subdir_level]),
-            append ? "appended" : (
-            transfer_type == FILE_XFER_MOVE?"moved":"copied"),
-            strcmp(dest_filespec, "*.*")==0?full_dest_dirspec:full_dest_filespec);
-          xfer_count++;
-          }
-        }
-      }
-    else
-      {
-      if (traverse_subdirs)
-        visitation_mode[subdir_level]--;
-      else
-        visitation_mode[subdir_level] = 0;
-      if (visitation_mode[subdir_level] <= 0)
-        subdir_level--;
-      }
+  // one conventional memory buffer serves all files of this transfer
+  fcopy_buf_alloc();
+  if (show_stats)
+    {
+    int dinfo = _get_dev_info(STDOUT_FILENO);
+
+    // the percentage line is redrawn in place, keep it out of files
+    if (dinfo != -1 && IS_CHRDEV(dinfo))
+      fcopy_set_progress(show_copy_progress);
+    gettimeofday(&start_tv, NULL);
     }
-  if (xfer_count == 0)
+
+  // visit each directory; perform transfer
+  rc = walk_tree(&w, source_path);
+  walk_done(&w);
+  fcopy_set_progress(NULL);
+  fcopy_buf_free();
+  if (rc != 0)
+    {
+    reset_batfile_call_stack();
+    return;
+    }
+
+  x.skip_count += w.filtered;
+  if (x.xfer_count == 0 && x.skip_count == 0)
     printf("File(s) not found - %s%s\n", source_path, source_filespec);
+  else if (only_newer || archive_only)
+    printf("%9d file(s) copied, %d skipped\n", x.xfer_count, x.skip_count);
   else
     {
     if (transfer_type == FILE_XFER_MOVE)
-      printf("%9d file(s) moved\n", xfer_count);
+      printf("%9d file(s) moved\n", x.xfer_count);
     else
-      printf("%9d file(s) copied\n", xfer_count);
+      printf("%9d file(s) copied\n", x.xfer_count);
     }
-ExitOperation:
+  if (show_stats)
+    print_xfer_stats(&w, x.xfer_count, x.xfer_bytes, &start_tv);
   return;
 
 InvalidSwitch:
@@ -1674,38 +1941,34 @@ InvalidSwitch:
   return;
   }
 
-static int get_set_file_attribute(char *full_path_filespec, unsigned req_attrib, unsigned attrib_mask)
+/* Show the attributes that find data reported, or change them. Files
+ * that already have the requested attributes are left alone. */
+static int get_set_file_attribute(char *full_path_filespec, unsigned actual_attrib,
+    unsigned req_attrib, unsigned attrib_mask)
   {
   int a;
-  unsigned actual_attrib;
+  unsigned new_attrib;
+  char flags[4 * 3 + 1], *f = flags;
 
-  if (attrib_mask == 0)
+  if (attrib_mask != 0)
     {
-    if (getfileattr(full_path_filespec, &actual_attrib) != 0)
-      {
-      cprintf("Cannot read attribute - %s\r\n", full_path_filespec);
-      return -1;
-      }
-    }
-  else
-    {
-    if (getfileattr(full_path_filespec, &actual_attrib) != 0)
-      actual_attrib = 0;
-    actual_attrib &= (~attrib_mask);
-    actual_attrib |= (req_attrib & attrib_mask);
-    if (setfileattr(full_path_filespec, actual_attrib) != 0)
+    new_attrib = (actual_attrib & ~attrib_mask) | (req_attrib & attrib_mask);
+    if (new_attrib == actual_attrib)
+      return 0;
+    if (setfileattr(full_path_filespec, new_attrib) != 0)
       goto CantSetAttr;
-    printf("Attribute set to ");
+    actual_attrib = new_attrib;
     }
 
   for (a = 0; a < 4; a++)
     {
     if ((actual_attrib&attrib_values[a]) == 0)
-      printf(" -%c",tolower(attrib_letters[a]));
+      f += sprintf(f, " -%c", tolower(attrib_letters[a]));
     else
-      printf(" +%c",toupper(attrib_letters[a]));
+      f += sprintf(f, " +%c", toupper(attrib_letters[a]));
     }
-  printf("  - %s\n", full_path_filespec);
+  printf("%s%s  - %s\n", attrib_mask ? "Attribute set to " : "", flags,
+      full_path_filespec);
   return 0;
 
 CantSetAttr:
@@ -1715,28 +1978,31 @@ CantSetAttr:
 
 ///////////////////////////////////////////////////////////////////////////////////
 
+struct attrib_req
+  {
+  unsigned req_attrib;
+  unsigned attrib_mask;
+  };
+
+static int attrib_file(struct walk *w, finddata_t *ff)
+  {
+  struct attrib_req *req = w->arg;
+
+  return get_set_file_attribute(w->path, FINDDATA_T_ATTRIB((*ff)),
+      req->req_attrib, req->attrib_mask);
+  }
+
 static void perform_attrib(const char *arg)
   {
-  long ffhandle = 0;
-  int ffrc;
-  int file_count = 0;
+  struct walk w;
+  int rc;
   int traverse_subdirs = false;
-  int s, subdir_level = 0;
-  finddata_t ff[MAX_SUBDIR_LEVEL];
-  char dir_name[MAX_SUBDIR_LEVEL][MAXPATH];
-  int visitation_mode[MAX_SUBDIR_LEVEL]; // 4 = findfirst source_filespec for files;
-                                         // 3 = findnext source_filespec for files;
-                                         // 2 = findfirst *.* for subdirs;
-                                         // 1 = findnext *.* for subdirs;
-                                         // 0 = done
   char drivespec[MAXDRIVE], dirspec[MAXDIR], filename[MAXFILE], extspec[MAXEXT];
   char temp_path[MAXPATH];
   char path[MAXPATH] = "", filespec[MAXPATH];
-  char full_path_filespec[MAXPATH];
 
   int a;
-  unsigned req_attrib = 0, attrib_mask = 0;
-  unsigned search_attrib;
+  struct attrib_req req = { 0, 0 };
 
   while (*arg != '\0')
     {
@@ -1748,11 +2014,11 @@ static void perform_attrib(const char *arg)
           {
           if (toupper(arg[1]) == toupper(attrib_letters[a]))
             {
-            attrib_mask |= attrib_values[a];
+            req.attrib_mask |= attrib_values[a];
             if (arg[0] == '+')
-              req_attrib |= attrib_values[a];
+              req.req_attrib |= attrib_values[a];
             else
-              req_attrib &= (~(attrib_values[a]));
+              req.req_attrib &= (~(attrib_values[a]));
             }
           }
         }
@@ -1808,81 +2074,19 @@ static void perform_attrib(const char *arg)
   conv_unix_path_to_ms_dos(filespec);
 
   // visit each directory; perform attrib get/set
-  visitation_mode[0] = 4;
-  dir_name[0][0] = '\0';
-  while (subdir_level >= 0)
+  walk_init(&w, filespec);
+  w.recurse = traverse_subdirs;
+  w.attrib = FA_RDONLY+FA_ARCH+FA_SYSTEM+FA_HIDDEN;
+  w.file = attrib_file;
+  w.arg = &req;
+  rc = walk_tree(&w, path);
+  walk_done(&w);
+  if (rc != 0)
     {
-    if (visitation_mode[subdir_level] == 4 || visitation_mode[subdir_level] == 2)
-      {
-      strcpy(full_path_filespec, path);
-      for (s = 0; s <= subdir_level; s++)
-        strcat(full_path_filespec, dir_name[s]);
-      if (visitation_mode[subdir_level] == 4)
-        {
-        strcat(full_path_filespec, filespec);
-        search_attrib = FA_RDONLY+FA_ARCH+FA_SYSTEM+FA_HIDDEN;
-        }
-      else
-        {
-        strcat(full_path_filespec, "*.*");
-        search_attrib = FA_DIREC+FA_RDONLY+FA_ARCH+FA_SYSTEM+FA_HIDDEN;
-        }
-      ffrc = findfirst_f(full_path_filespec, &(ff[subdir_level]), search_attrib, &ffhandle);
-      visitation_mode[subdir_level]--;
-      }
-    else
-      ffrc = findnext_f(&(ff[subdir_level]), ffhandle);
-    if (ffrc == 0)
-      {
-      conv_unix_path_to_ms_dos(FINDDATA_T_FILENAME(ff[subdir_level]));
-      strcpy(full_path_filespec, path);
-      for (s = 0; s <= subdir_level; s++)
-        strcat(full_path_filespec, dir_name[s]);
-      strcat(full_path_filespec, FINDDATA_T_FILENAME(ff[subdir_level]));
-
-      if ((FINDDATA_T_ATTRIB(ff[subdir_level])&FA_DIREC) != 0)
-        {
-        if (visitation_mode[subdir_level] <= 2 &&
-            traverse_subdirs &&
-            strcmp(FINDDATA_T_FILENAME(ff[subdir_level]),".") != 0 &&
-            strcmp(FINDDATA_T_FILENAME(ff[subdir_level]),"..") != 0)
-          {
-          subdir_level++;
-          if (subdir_level >= MAX_SUBDIR_LEVEL)
-            {
-            cputs("Directory tree is too deep\r\n");
-            reset_batfile_call_stack();
-            return;
-            }
-          visitation_mode[subdir_level] = 4;
-          strcpy(dir_name[subdir_level], FINDDATA_T_FILENAME(ff[subdir_level-1]));
-          strcat(dir_name[subdir_level], "\\");
-          }
-        }
-      else
-        {
-        if (visitation_mode[subdir_level] > 2)
-          {
-          if (get_set_file_attribute(full_path_filespec, req_attrib, attrib_mask) != 0)
-            {
-            reset_batfile_call_stack();
-            return;
-            }
-          file_count++;
-          }
-        }
-      }
-    else
-      {
-      if (traverse_subdirs)
-        visitation_mode[subdir_level]--;
-      else
-        visitation_mode[subdir_level] = 0;
-      if (visitation_mode[subdir_level] <= 0)
-        subdir_level--;
-      }
+    reset_batfile_call_stack();
+    return;
     }
-  if (file_count == 0)
+  if (w.files == 0)
     printf("File(s) not found - %s%s\n", path, filespec);
   }
 
@@ -2191,24 +2395,136 @@ static int expand_pluses(void)
   last_arg = strrchr(cmd_args_bkp, ' ');
   if (!last_arg)
     {
-    cprintf("syntax error\n");
-    return -1;
+    cprintf("syntax error\n");
+    return -1;
+    }
+  len = 0;
+  cmd_args[0] = '\0';
+  for (p2 = cmd_args_bkp, p = strchr(p2, '+'); p;
+       p2 = p + 1, p = strchr(p2, '+'))
+    {
+    len += snprintf(cmd_args + len, sizeof(cmd_args) - len, "%.*s %s;",
+        (int)(p - p2), p2, last_arg);
+    }
+  strlcat(cmd_args, p2, sizeof(cmd_args));
+  return 0;
+}
+
+#define MAX_CONCAT_SOURCES 32
+
+/* Plain "copy a+b+c dest": open the destination once and stream all
+ * the sources into it. Returns 0 if the command is not that simple
+ * (wildcards, switches, devices, dest is a dir), so that the caller
+ * falls back to copying group by group. */
+static int copy_concat(void)
+  {
+  char args[MAX_CMD_BUFLEN];
+  char *src[MAX_CONCAT_SOURCES], *dest, *p;
+  char full_dest[MAXPATH], full_src[MAXPATH];
+  int num = 0, i, first = 0, dest_fd, source_fd = -1;
+  struct stat st;
+
+  strcpy(args, cmd_args);
+  if (strpbrk(args, "/\"*?") != NULL)
+    return 0;
+  p = args + strlen(args);
+  while (p > args && p[-1] == ' ')
+    *--p = '\0';
+  dest = strrchr(args, ' ');
+  if (dest == NULL)
+    return 0;
+  *dest++ = '\0';
+  /* sources must be joined by '+', "a+b c d" is not a concatenation */
+  for (p = strtok(args, "+"); p; p = strtok(NULL, "+"))
+    {
+    char *end;
+
+    while (*p == ' ')
+      p++;
+    end = p + strlen(p);
+    while (end > p && end[-1] == ' ')
+      *--end = '\0';
+    if (*p == '\0' || strchr(p, ' ') || num == MAX_CONCAT_SOURCES)
+      return 0;
+    src[num++] = p;
+    }
+  if (num < 2 || file_access(dest, D_OK) == 0)
+    return 0;
+
+  _fixpath(dest, full_dest);
+  for (i = 0; i < num; i++)
+    {
+    if (stat(src[i], &st) != 0 || (st.st_mode & S_IFCHR))
+      return 0;
+    _fixpath(src[i], full_src);
+    if (stricmp(full_src, full_dest) == 0)
+      {
+      // "copy a+b a" appends to a; anything else would clobber a source
+      if (i != 0)
+        return 0;
+      first = 1;
+      }
+    }
+
+  dest_fd = open(dest, O_WRONLY | O_BINARY | O_CREAT | (first ? 0 : O_TRUNC),
+      S_IRUSR | S_IWUSR);
+  if (dest_fd == -1)
+    {
+    cprintf("Unable to open destination file - %s\r\n", dest);
+    goto error;
     }
-  len = 0;
-  cmd_args[0] = '\0';
-  for (p2 = cmd_args_bkp, p = strchr(p2, '+'); p;
-       p2 = p + 1, p = strchr(p2, '+'))
+  if (first && lseek(dest_fd, 0, SEEK_END) == -1)
+    goto error_close;
+  fcopy_buf_alloc();
+  for (i = first; i < num; i++)
     {
-    len += snprintf(cmd_args + len, sizeof(cmd_args) - len, "%.*s %s;",
-        (int)(p - p2), p2, last_arg);
+    source_fd = open(src[i], O_RDONLY | O_BINARY);
+    if (source_fd == -1)
+      {
+      cprintf("Unable to open source file - %s\r\n", src[i]);
+      goto error_close;
+      }
+    if (fstat(source_fd, &st) != 0 ||
+        fcopy_fd(dest_fd, source_fd, st.st_size, NULL) != 0)
+      {
+      cprintf("Error occurred while copying to file - %s\r\n", dest);
+      goto error_close;
+      }
+    // the result gets the time of the last source, as it always did
+    if (i < num - 1)
+      close(source_fd);
+    printf("%s %s to %s\n", src[i], i == 0 ? "copied" : "appended", dest);
     }
-  strlcat(cmd_args, p2, sizeof(cmd_args));
-  return 0;
-}
+  file_copytime(dest_fd, source_fd);
+  close(source_fd);
+  fcopy_buf_free();
+  if (close(dest_fd) != 0)
+    {
+    cprintf("Error occurred while copying to file - %s\r\n", dest);
+    goto error;
+    }
+  printf("%9d file(s) copied\n", 1);
+  return 1;
+
+error_close:
+  if (source_fd != -1)
+    close(source_fd);
+  fcopy_buf_free();
+  close(dest_fd);
+  if (!first)
+    remove(dest);
+error:
+  reset_batfile_call_stack();
+  return 1;
+  }
 
 static void perform_copy(const char *arg)
   {
-  int err = expand_pluses();
+  int err;
+
+  if (strchr(cmd_args, '+') && copy_concat())
+    return;
+  err = expand_pluses();
   if (err)
     return;
   general_file_transfer(FILE_XFER_COPY, 0);
@@ -2227,8 +2543,6 @@ static void perform_xcopy(const char *arg)
   general_file_transfer(FILE_XFER_XCOPY, 0);
   }
 
-#define IS_CHRDEV(d) ((d) & _DEV_CDEV)
-
 static void perform_ctty(const char *arg)
   {
   __dpmi_regs r = {};
@@ -2349,14 +2663,29 @@ static void perform_date(const char *arg)
                              loctime.tm_mon+1, loctime.tm_mday, loctime.tm_year+1900);
   }
 
+static int delete_file(struct walk *w, finddata_t *ff)
+  {
+  int *quiet = w->arg;
+
+  if (remove(w->path) != 0)
+    {
+    cprintf("Access denied - %s\r\n", w->path);
+    return -1;
+    }
+  if (!*quiet)
+    printf("%s erased\n", w->path);
+  return 0;
+  }
+
 static void perform_delete(const char *arg)
   {
-  long fhandle;
-  finddata_t ff;
   char filespec[MAXPATH] = "";
   char full_filespec[MAXPATH] = "";
-  char drive[MAXDRIVE], dir[MAXDIR];
-  int done = 0;
+  char path[MAXPATH];
+  char drive[MAXDRIVE], dir[MAXDIR], name[MAXFILE], ext[MAXEXT];
+  int quiet = false, recurse = false;
+  struct walk w;
+  int rc;
 
   while (*arg != '\0')
     {
@@ -2374,6 +2703,11 @@ static void perform_delete(const char *arg)
         return;
         }
       }
+    else if (stricmp(cmd_switch, "/q") == 0)
+      quiet = true;
+    else if (stricmp(cmd_switch, "/s") == 0)
+      recurse = true;
+    // other switches, like /p, are ignored as they always were
     advance_cmd_arg();
     }
   if (*filespec == '\0')
@@ -2384,57 +2718,90 @@ static void perform_delete(const char *arg)
     }
 
   _fixpath(filespec, full_filespec);
-  fnsplit(full_filespec, drive, dir, NULL, NULL);
-  conv_unix_path_to_ms_dos(drive);
-  conv_unix_path_to_ms_dos(dir);
+  fnsplit(full_filespec, drive, dir, name, ext);
+  strcpy(path, drive);
+  strcat(path, dir);
+  strcat(name, ext);
+  conv_unix_path_to_ms_dos(path);
 
-  if (findfirst_f(full_filespec, &ff, 0, &fhandle) != 0)
-    {
+  walk_init(&w, name);
+  w.recurse = recurse;
+  w.file = delete_file;
+  w.arg = &quiet;
+  rc = walk_tree(&w, path);
+  walk_done(&w);
+  if (rc != 0)
+    error_level = 1;
+  else if (w.files == 0)
     printf("File(s) not found - %s\n", filespec);  // informational msg; not an error
-    return;
+  else if (quiet)
+    printf("%9lu file(s) erased\n", w.files);
+  }
+
+struct deltree_ctx
+  {
+  int confirm_before_delete;
+  int file_count;
+  int dir_count;
+  };
+
+static int deltree_file(struct walk *w, finddata_t *ff)
+  {
+  struct deltree_ctx *ctx = w->arg;
+
+  if (ctx->confirm_before_delete && w->level == 0)
+    {
+    cprintf("Delete file %s ? [Y/N] ", w->path);
+    if (get_choice("YN") != 'Y')
+      return 0;
     }
-  while (!done)
+  if (remove(w->path) != 0)
     {
-    char individual_filespec[MAXPATH];
+    cprintf("Unable to delete file - %s\r\n", w->path);
+    return -1;
+    }
+  if (w->level == 0)
+    printf("%s deleted\n", w->path);
+  ctx->file_count++;
+  return 0;
+  }
 
-    conv_unix_path_to_ms_dos(FINDDATA_T_FILENAME(ff));
-    strcpy(individual_filespec, drive);
-    strcat(individual_filespec, dir);
-    strcat(individual_filespec, FINDDATA_T_FILENAME(ff));
+static int deltree_dir_pre(struct walk *w, const char *name)
+  {
+  struct deltree_ctx *ctx = w->arg;
 
-    done = (findnext_f(&ff, fhandle) != 0);
-    if (remove(individual_filespec) == 0)
-      printf("%s erased\n", individual_filespec);
-    else
-      {
-      cprintf("Access denied - %s\r\n", individual_filespec);
-      error_level = 1;
-      return;
-      }
+  if (ctx->confirm_before_delete && w->level == 0)
+    {
+    cprintf("Delete directory %s and all its subdirectories? [Y/N] ", w->path);
+    if (get_choice("YN") != 'Y')
+      return WALK_SKIP;
+    }
+  return 0;
+  }
+
+static int deltree_dir_post(struct walk *w, const char *name)
+  {
+  struct deltree_ctx *ctx = w->arg;
+
+  if (rmdir(w->path) != 0)
+    {
+    cprintf("Unable to remove directory - %s\\\r\n", w->path);
+    return -1;
     }
+  if (w->level == 0)
+    printf("%s removed\n", w->path);
+  ctx->dir_count++;
+  return 0;
   }
 
 static void perform_deltree(const char *arg)
   {
-  long ffhandle = 0;
-  int ffrc;
-  int file_count = 0, dir_count = 0;
-  int s, subdir_level = 0;
-  int confirm_before_delete = true;
-  finddata_t ff[MAX_SUBDIR_LEVEL];
-  char dir_name[MAX_SUBDIR_LEVEL][MAXPATH];
-  int remove_level1_dir;
-  int visitation_mode[MAX_SUBDIR_LEVEL]; // 4 = findfirst source_filespec for files;
-                                         // 3 = findnext source_filespec for files;
-                                         // 2 = findfirst *.* for subdirs;
-                                         // 1 = findnext *.* for subdirs;
-                                         // 0 = done
+  struct deltree_ctx ctx = { .confirm_before_delete = true };
+  struct walk w;
   char drivespec[MAXDRIVE], dirspec[MAXDIR], filename[MAXFILE], extspec[MAXEXT];
   char temp_path[MAXPATH];
   char path[MAXPATH] = "", filespec[MAXPATH];
-  char full_path_filespec[MAXPATH];
-  int choice;
-  unsigned search_attrib;
+  int rc;
 
   while (*arg != '\0')
     {
@@ -2456,7 +2823,7 @@ static void perform_deltree(const char *arg)
     else
       {
       if (stricmp(cmd_switch,"/Y") == 0)
-        confirm_before_delete = false;
+        ctx.confirm_before_delete = false;
       else
         {
         cprintf("Invalid switch - %s\r\n", cmd_switch);
@@ -2489,147 +2856,221 @@ static void perform_deltree(const char *arg)
   conv_unix_path_to_ms_dos(filespec);
 
   // visit each directory; delete files and subdirs
-  visitation_mode[0] = 4;
-  dir_name[0][0] = '\0';
-  remove_level1_dir = false;
-  /* visitation mode:
-   * 4 - find_first on files
-   * 3 - find_next on files
-   * 2 - find_first on dirs
-   * 1 - find_next on dirs
-   * 0 - this dir is fully traversed
-   */
-  while (subdir_level >= 0)
-    {
-    if (visitation_mode[subdir_level] == 4 || visitation_mode[subdir_level] == 2)
-      {
-      strcpy(full_path_filespec, path);
-      for (s = 0; s <= subdir_level; s++)
-        strcat(full_path_filespec, dir_name[s]);
-      if (subdir_level == 0)
-        strcat(full_path_filespec, filespec);
-      else
-        strcat(full_path_filespec, "*.*");
-      if (visitation_mode[subdir_level] == 4)
-        search_attrib = FA_RDONLY+FA_ARCH+FA_SYSTEM+FA_HIDDEN;
-      else
-        search_attrib = FA_DIREC+FA_RDONLY+FA_ARCH+FA_SYSTEM+FA_HIDDEN;
-      ffrc = findfirst_f(full_path_filespec, &(ff[subdir_level]), search_attrib, &ffhandle);
-      visitation_mode[subdir_level]--;
+  walk_init(&w, filespec);
+  w.sub_spec = "*.*";
+  w.top_dirs_by_spec = true;
+  w.recurse = true;
+  w.attrib = FA_RDONLY+FA_ARCH+FA_SYSTEM+FA_HIDDEN;
+  w.file = deltree_file;
+  w.dir_pre = deltree_dir_pre;
+  w.dir_post = deltree_dir_post;
+  w.arg = &ctx;
+  rc = walk_tree(&w, path);
+  walk_done(&w);
+  if (rc != 0)
+    {
+    error_level = 1;
+    return;
+    }
+  printf("%9d file(s) deleted, ", ctx.file_count);
+  if (ctx.dir_count == 1)
+    printf("%9d directory removed\n", ctx.dir_count);
+  else
+    printf("%9d (sub)directories removed\n", ctx.dir_count);
+  }
+
+/* DIR entry as kept for /O sorting. The name lives in a separate
+ * string pool, so that the records stay small and fixed-size. */
+struct dir_ent
+  {
+  uint32_t name_off;
+  uint32_t size;
+  uint32_t stamp;  // FINDDATA_T_WSTAMP, decoded with WSTAMP_*
+  uint8_t attrib;
+  };
+
+struct dir_list
+  {
+  struct dir_ent *ents;
+  unsigned num;
+  unsigned max;
+  char *pool;
+  uint32_t pool_len;
+  uint32_t pool_size;
+  };
+
+#define DIR_MAX_SORT_KEYS 5
+static char dir_sort_keys[DIR_MAX_SORT_KEYS + 1];  // upper case: ascending
+static const struct dir_list *dir_sort_list;
+
+static void dir_ent_fill(struct dir_ent *e, finddata_t *ff)
+  {
+  e->size = FINDDATA_T_SIZE((*ff));
+  e->stamp = FINDDATA_T_WSTAMP((*ff));
+  e->attrib = FINDDATA_T_ATTRIB((*ff));
+  }
+
+static int dir_list_add(struct dir_list *l, finddata_t *ff)
+  {
+  const char *name = FINDDATA_T_FILENAME((*ff));
+  uint32_t nlen = strlen(name) + 1;
+
+  if (l->num == l->max)
+    {
+    unsigned max = l->max ? l->max * 2 : 256;
+    struct dir_ent *ents = realloc(l->ents, max * sizeof(*ents));
+    if (ents == NULL)
+      return -1;
+    l->ents = ents;
+    l->max = max;
+    }
+  if (l->pool_len + nlen > l->pool_size)
+    {
+    uint32_t size = l->pool_size ? l->pool_size * 2 : 4096;
+    char *pool;
+
+    while (l->pool_len + nlen > size)
+      size *= 2;
+    pool = realloc(l->pool, size);
+    if (pool == NULL)
+      return -1;
+    l->pool = pool;
+    l->pool_size = size;
+    }
+  dir_ent_fill(&l->ents[l->num], ff);
+  l->ents[l->num].name_off = l->pool_len;
+  memcpy(l->pool + l->pool_len, name, nlen);
+  l->pool_len += nlen;
+  l->num++;
+  return 0;
+  }
+
+static const char *dir_ent_ext(const char *name)
+  {
+  const char *p = strrchr(name, '.');
+
+  return (p && p != name) ? p + 1 : "";
+  }
+
+static int dir_ent_cmp(const void *p1, const void *p2)
+  {
+  unsigned i1 = *(const unsigned *)p1, i2 = *(const unsigned *)p2;
+  const struct dir_ent *e1 = &dir_sort_list->ents[i1];
+  const struct dir_ent *e2 = &dir_sort_list->ents[i2];
+  const char *n1 = dir_sort_list->pool + e1->name_off;
+  const char *n2 = dir_sort_list->pool + e2->name_off;
+  const char *k;
+
+  for (k = dir_sort_keys; *k; k++)
+    {
+    int c = 0;
+
+    switch (toupper(*k))
+      {
+      case 'N':
+        c = stricmp(n1, n2);
+        break;
+      case 'E':
+        c = stricmp(dir_ent_ext(n1), dir_ent_ext(n2));
+        break;
+      case 'S':
+        c = (e1->size > e2->size) - (e1->size < e2->size);
+        break;
+      case 'D':
+        c = (e1->stamp > e2->stamp) - (e1->stamp < e2->stamp);
+        break;
+      case 'G':
+        c = ((e2->attrib & FA_DIREC) != 0) - ((e1->attrib & FA_DIREC) != 0);
+        break;
       }
-    else
-      ffrc = findnext_f(&(ff[subdir_level]), ffhandle);
-    if (ffrc == 0)
+    if (c)
+      return islower(*k) ? -c : c;
+    }
+  return (i1 > i2) - (i1 < i2);  // keep the find order otherwise
+  }
+
+/* Parse the letters of /O[:][-]N|E|S|D|G..., "-" reverses the next key. */
+static int dir_parse_sort(const char *s)
+  {
+  int n = 0, rev = 0;
+
+  if (*s == ':')
+    s++;
+  if (*s == '\0')
+    s = "GN";
+  for (; *s; s++)
+    {
+    if (*s == '-')
       {
-      conv_unix_path_to_ms_dos(FINDDATA_T_FILENAME(ff[subdir_level]));
-      strcpy(full_path_filespec, path);
-      for (s = 0; s <= subdir_level; s++)
-        strcat(full_path_filespec, dir_name[s]);
-      strcat(full_path_filespec, FINDDATA_T_FILENAME(ff[subdir_level]));
+      rev = 1;
+      continue;
+      }
+    if (!strchr("NESDG", toupper(*s)) || n >= DIR_MAX_SORT_KEYS)
+      return -1;
+    dir_sort_keys[n++] = rev ? tolower(*s) : toupper(*s);
+    rev = 0;
+    }
+  dir_sort_keys[n] = '\0';
+  return 0;
+  }
 
-      if ((FINDDATA_T_ATTRIB(ff[subdir_level])&FA_DIREC) != 0) // found dir
-        {
-        if (visitation_mode[subdir_level] <= 2 &&
-            strcmp(FINDDATA_T_FILENAME(ff[subdir_level]),".") != 0 &&
-            strcmp(FINDDATA_T_FILENAME(ff[subdir_level]),"..") != 0)
-          {
-          if (subdir_level == 0)
-            {
-            if (confirm_before_delete)
-              {
-              cprintf("Delete directory %s and all its subdirectories? [Y/N] ", full_path_filespec);
-              remove_level1_dir = (get_choice("YN") == 'Y');
-              }
-            else
-              remove_level1_dir = true;
-            }
-          if (subdir_level > 0 || remove_level1_dir)
-            {
-            /* Close cur dir when entering next level. We need this
-             * for 2 reasons:
-             * 1. In SFN mode there are no handles, so ff process needs
-             *    to be restarted on backtrack (see 7e3365bd).
-             *    To unify with LFN mode, we restart in both cases.
-             * 2. Even special-casing LFN mode may not be safe as it
-             *    has the limited amount of ff handles.
-             * So just close handle and restart later. For SFN, close
-             * is a no-op.
-             */
-            findclose_f(ffhandle);
-            subdir_level++;
-            if (subdir_level >= MAX_SUBDIR_LEVEL)
-              {
-              cputs("Directory tree is too deep\r\n");
-              reset_batfile_call_stack();
-              return;
-              }
-            visitation_mode[subdir_level] = 4;
-            strcpy(dir_name[subdir_level], FINDDATA_T_FILENAME(ff[subdir_level-1]));
-            strcat(dir_name[subdir_level], "\\");
-            }
-          }
-        }
-      else  // found file
+static void dir_print_ent(const struct dir_ent *e, const char *name,
+    int *wide_column_countdown)
+  {
+  if (*wide_column_countdown < 0)
+    {
+    printf("%04d-%02d-%02d ", (int)WSTAMP_YEAR(e->stamp),
+        (int)WSTAMP_MON(e->stamp), (int)WSTAMP_DAY(e->stamp));
+    printf("%02d:%02d ", (int)WSTAMP_HOUR(e->stamp),
+        (int)WSTAMP_MIN(e->stamp));
+    if ((e->attrib&FA_DIREC) == 0)
+      printf("%13u", (unsigned)e->size);
+    else
+      printf("<DIR>%8s", "");
+    printf(" %s\n", name);
+    }
+  else
+    {
+    if ((e->attrib&FA_DIREC) == 0)
+      printf("%-14s", name);
+    else
+      {
+      int len = strlen(name) + 2;
+      printf("[%s]", name);
+      while (len < 14)
         {
-        if (visitation_mode[subdir_level] > 2)
-          {
-          if (confirm_before_delete && subdir_level == 0)
-            {
-            cprintf("Delete file %s ? [Y/N] ", full_path_filespec);
-            choice = get_choice("YN");
-            }
-          else
-            choice = 'Y';
-          if (choice == 'Y')
-            {
-            if (remove(full_path_filespec) != 0)
-              {
-              cprintf("Unable to delete file - %s\r\n", full_path_filespec);
-              error_level = 1;
-              return;
-              }
-            if (subdir_level == 0)
-              printf("%s deleted\n", full_path_filespec);
-            file_count++;
-            }
-          }
+        printf(" ");
+        len++;
         }
       }
-    else  // no more matches
+    (*wide_column_countdown)--;
+    if (*wide_column_countdown == 0)
       {
-      visitation_mode[subdir_level]--;
-      if (visitation_mode[subdir_level] <= 0)
-        {
-        if (subdir_level > 0)
-          {
-          strcpy(full_path_filespec, path);
-          for (s = 0; s <= subdir_level; s++)
-            strcat(full_path_filespec, dir_name[s]);
-          *(strrchr(full_path_filespec,'\\')) = '\0';
-          if (subdir_level > 1 || remove_level1_dir)
-            {
-            if (rmdir(full_path_filespec) != 0)
-              {
-              cprintf("Unable to remove directory - %s\\\r\n", full_path_filespec);
-              error_level = 1;
-              return;
-              }
-            if (subdir_level == 1)
-              printf("%s removed\n", full_path_filespec);
-            dir_count++;
-            }
-          }
-        subdir_level--;
-        if (subdir_level >= 0)
-          visitation_mode[subdir_level]++;  // 2 - restart from findfirst
-        }
+      puts("");
+      *wide_column_countdown = 5;
       }
+    else
+      printf("  ");
     }
-  printf("%9d file(s) deleted, ", file_count);
-  if (dir_count == 1)
-    printf("%9d directory removed\n", dir_count);
-  else
-    printf("%9d (sub)directories removed\n", dir_count);
+  }
+
+/* Wait for a key when the screen is full, return 1 to stop listing. */
+static int dir_pause(struct text_info *txinfo)
+  {
+  int rc;
+
+  fflush(stdout);
+  if (wherey() != txinfo->winbottom)
+    return 0;
+  printf("Press any key to continue, or q to stop...");
+  rc = keyb_get_rawcode();
+  if (rc == 3 || toupper(rc) == 'Q')
+    {
+    printf("\n");
+    return 1;
+    }
+  clrscr();
+  return 0;
   }
 
 static void perform_dir(const char *arg)
@@ -2649,6 +3090,10 @@ static void perform_dir(const char *arg)
   char full_filespec[MAXPATH];
   char filespec[MAXPATH] = "";
   struct text_info txinfo;
+  struct dir_ent e;
+  struct dir_list list = {};
+  unsigned *order = NULL, i;
+  int sorted = false;
 
   gettextinfo(&txinfo);
 
@@ -2678,6 +3123,16 @@ static void perform_dir(const char *arg)
         use_pause = 1;
         clrscr();
         }
+      if (strnicmp(cmd_switch,"/o",2)==0)
+        {
+        if (dir_parse_sort(cmd_switch+2) != 0)
+          {
+          cprintf("Invalid switch - %s\r\n", cmd_switch);
+          reset_batfile_call_stack();
+          return;
+          }
+        sorted = true;
+        }
       }
     advance_cmd_arg();
     }
@@ -2718,17 +3173,8 @@ static void perform_dir(const char *arg)
   first = true;
   for (;;)
     {
-    if (use_pause && wherey() == txinfo.winbottom)
-      {
-      printf("Press any key to continue, or q to stop...");
-      rc = keyb_get_rawcode();
-      if (rc == 3 || toupper(rc) == 'Q')
-        {
-        printf("\n");
-        break;
-        }
-      clrscr();
-      }
+    if (!sorted && use_pause && dir_pause(&txinfo))
+      break;
     if (first)
       {
       if (((ffrc = findfirst_f(full_filespec, &ff, attrib, &ffhandle)) != 0) ||
@@ -2745,38 +3191,19 @@ static void perform_dir(const char *arg)
         break;
       }
     conv_unix_path_to_ms_dos(FINDDATA_T_FILENAME(ff));
-    if (wide_column_countdown < 0)
+    if (sorted)
       {
-      printf("%04d-%02d-%02d ", FINDDATA_T_WDATE_YEAR(ff), FINDDATA_T_WDATE_MON(ff), FINDDATA_T_WDATE_DAY(ff));
-      printf("%02d:%02d ", FINDDATA_T_WTIME_HOUR(ff), FINDDATA_T_WTIME_MIN(ff));
-      if ((FINDDATA_T_ATTRIB(ff)&FA_DIREC) == 0)
-        printf("%13u", FINDDATA_T_SIZE(ff));
-      else
-        printf("<DIR>%8s", "");
-      printf(" %s\n", FINDDATA_T_FILENAME(ff));
+      if (dir_list_add(&list, &ff) != 0)
+        {
+        findclose_f(ffhandle);
+        cputs("Insufficient memory\r\n");
+        goto out;
+        }
       }
     else
       {
-      if ((FINDDATA_T_ATTRIB(ff)&FA_DIREC) == 0)
-        printf("%-14s", FINDDATA_T_FILENAME(ff));
-      else
-        {
-        int len = strlen(FINDDATA_T_FILENAME(ff)) + 2;
-        printf("[%s]", FINDDATA_T_FILENAME(ff));
-        while (len < 14)
-          {
-          printf(" ");
-          len++;
-          }
-        }
-      wide_column_countdown--;
-      if (wide_column_countdown == 0)
-        {
-        puts("");
-        wide_column_countdown = 5;
-        }
-      else
-        printf("  ");
+      dir_ent_fill(&e, &ff);
+      dir_print_ent(&e, FINDDATA_T_FILENAME(ff), &wide_column_countdown);
       }
 
     if ((FINDDATA_T_ATTRIB(ff)&FA_DIREC) == 0)
@@ -2787,6 +3214,27 @@ static void perform_dir(const char *arg)
     else
       dircount++;
     }
+  if (sorted && list.num > 0)
+    {
+    order = malloc(list.num * sizeof(*order));
+    if (order == NULL)
+      {
+      cputs("Insufficient memory\r\n");
+      goto out;
+      }
+    for (i = 0; i < list.num; i++)
+      order[i] = i;
+    dir_sort_list = &list;
+    qsort(order, list.num, sizeof(*order), dir_ent_cmp);
+    for (i = 0; i < list.num; i++)
+      {
+      struct dir_ent *ent = &list.ents[order[i]];
+
+      if (use_pause && dir_pause(&txinfo))
+        break;
+      dir_print_ent(ent, list.pool + ent->name_off, &wide_column_countdown);
+      }
+    }
   if (wide_column_countdown >= 0 && wide_column_countdown < 5)
     puts("");
   printf("%10lu file(s) %14lu bytes\n", filecount, bytecount);
@@ -2806,6 +3254,10 @@ static void perform_dir(const char *arg)
   } else {
     printf("statvfs() failed\n");
   }
+out:
+  free(order);
+  free(list.ents);
+  free(list.pool);
 }
 
 static void perform_echo(const char *arg)
@@ -3142,10 +3594,13 @@ static void perform_external_cmd(int call, int lh, char *ext_cmd)
   char full_cmd[MAXPATH+MAX_CMD_BUFLEN] = "";
   char temp_cmd[MAXPATH+MAX_CMD_BUFLEN];
   int rc, i;
+
   int exec_type, e, ba;
   const char *exec_ext[3] = {".COM",".EXE",".BAT"};
   char *s;
 
+  fflush(stdout);
+
   // No wildcards allowed -- reject them
   if (has_wildcard(ext_cmd))
     goto BadCommand;
@@ -3632,21 +4087,31 @@ static void perform_md(const char *arg)
 static void perform_more(const char *arg)
   {
   struct text_info txinfo;
+  char buf[16384];
+  int len, cnt = 0;
 
   gettextinfo(&txinfo);
-  int c, cnt = 0;
-  while ((c = getchar()) != EOF)
+  fflush(stdout);
+  while ((len = read(STDIN_FILENO, buf, sizeof(buf))) > 0)
     {
-    putchar(c);
-    if (c == '\n')
+    char *start = buf, *p = buf, *end = buf + len;
+
+    // write a page at a time, or what is left of the block
+    while ((p = memchr(p, '\n', end - p)) != NULL)
       {
+      p++;
       if (++cnt == txinfo.winbottom - 1)
         {
         cnt = 0;
+        write(STDOUT_FILENO, start, p - start);
+        start = p;
         printf("--More--");
+        fflush(stdout);
         fgetc(bkp_stdin);
         }
       }
+    if (start < end)
+      write(STDOUT_FILENO, start, end - start);
     }
   }
 
@@ -4022,6 +4487,7 @@ static void perform_set(const char *arg)
       char buf[128];
       char *p;
       cputs(s);
+      fflush(stdout);
       p = fgets(buf, sizeof(buf), stdin);
       if (p)
         {
@@ -4173,9 +4639,9 @@ static void perform_truename(const char *arg)
 
 static void perform_type(const char *arg)
   {
-  FILE *textfile;
+  char buf[16384];
   char filespec[MAXPATH] = "";
-  int c;
+  int fd, len;
 
   while (*arg != '\0')
     {
@@ -4201,30 +4667,26 @@ static void perform_type(const char *arg)
     }
   /* HACK: open in text mode for dos, but then set binary mode for djgpp.
    * djgpp otherwise doesn't pass 0x1a to us (at least from device). */
-  textfile = fopen(filespec,"rt");
-  setbuf(textfile, NULL);
-  __file_handle_set(fileno(textfile), O_BINARY);
-  if (textfile != NULL)
-    {
-    while (1)
-      {
-      c = fgetc(textfile);
-      if (c == EOF)
-        break;
-      if (c == 0x1a || c == 3 || c == 0)
-        {
-        puts("");
-        break;
-        }
-      putchar(c);
-      }
-    fclose(textfile);
-    }
-  else
+  fd = open(filespec, O_RDONLY | O_TEXT);
+  if (fd == -1)
     {
     cprintf("Unable to open file - %s\r\n", filespec);
     error_level = 1;
+    return;
+    }
+  __file_handle_set(fd, O_BINARY);
+  while ((len = read(fd, buf, sizeof(buf))) > 0)
+    {
+    size_t n = type_span(buf, len);
+
+    fwrite(buf, 1, n, stdout);
+    if (n < len)
+      {
+      puts("");
+      break;
+      }
     }
+  close(fd);
   }
 
 static int is_blank(const char cc)
@@ -4367,7 +4829,10 @@ static void cl_write(const char *buf, int len)
   if (len && buf[len - 1] == '\0')
     len--;
   if (len)
+    {
+    fflush(stdout);
     write(STDOUT_FILENO, buf, len);
+    }
   }
 
 static void perform_clip(const char *arg)
@@ -4658,6 +5123,38 @@ quot:
   return;
   }
 
+/* Builtins print in many small pieces. Unbuffered, each of them is a
+ * DOS write, so buffer them: fully when going to a file or pipe, by
+ * line on the console. Anything that waits for a key or runs another
+ * program must fflush(stdout) first. */
+static char stdout_buf[4096];
+static int stdout_mode = _IONBF;
+
+/* Returns the previous mode for stdout_buffer_restore(), builtins
+ * like FOR and IF run other builtins nested. */
+static int stdout_buffer_on(void)
+  {
+  int dinfo = _get_dev_info(STDOUT_FILENO);
+  int prev = stdout_mode;
+
+  stdout_mode = _IOFBF;
+  if (dinfo != -1 && IS_CHRDEV(dinfo))
+    stdout_mode = _IOLBF;
+  fflush(stdout);
+  setvbuf(stdout, stdout_buf, stdout_mode, sizeof(stdout_buf));
+  return prev;
+  }
+
+static void stdout_buffer_restore(int mode)
+  {
+  fflush(stdout);
+  if (mode == _IONBF)
+    setvbuf(stdout, NULL, _IONBF, 0);
+  else
+    setvbuf(stdout, stdout_buf, mode, sizeof(stdout_buf));
+  stdout_mode = mode;
+  }
+
 static void exec_cmd(int call)
   {
   int c;
@@ -4765,7 +5262,9 @@ static void exec_cmd(int call)
         {
         if (stricmp(cmd, cmd_table[c].cmd_name) == 0)
           {
+          int mode = stdout_buffer_on();
           cmd_table[c].cmd_fn(cmd_arg);
+          stdout_buffer_restore(mode);
           break;
           }
         }
@@ -25,11 +25,6 @@
 #define STDIN_INDEX  0
 #define STDOUT_INDEX 1
 
-/*
- * Max subdirectory level, used by /S switch within XCOPY, ATTRIB and DELTREE
- */
-#define MAX_SUBDIR_LEVEL       15
-
 /*
  * File transfer modes
  */
@@ -70,6 +65,7 @@
 #define KEY_PGDN         KEY_EXTM(0x51E0)
 #define KEY_INSERT       KEY_EXTM(0x52E0)
 #define KEY_DELETE       KEY_EXTM(0x53E0)
+#define KEY_CTRL_R       KEY_ASCII(0x1312)
 
 /*
  * Common definitions
@@ -135,6 +131,13 @@ static inline int findclose_f(long handle)
 #define FINDDATA_T_WDATE_DAY(f) localtime(&f.time_write)->tm_mday
 #define FINDDATA_T_WTIME_HOUR(f) localtime(&f.time_write)->tm_hour
 #define FINDDATA_T_WTIME_MIN(f) localtime(&f.time_write)->tm_min
+#define FINDDATA_T_WSTAMP(f) (unsigned long)(f).time_write
+#define WSTAMP_TM(s) localtime(&(time_t){ (time_t)(s) })
+#define WSTAMP_YEAR(s) (WSTAMP_TM(s)->tm_year+1900)
+#define WSTAMP_MON(s) (WSTAMP_TM(s)->tm_mon+1)
+#define WSTAMP_DAY(s) (WSTAMP_TM(s)->tm_mday)
+#define WSTAMP_HOUR(s) (WSTAMP_TM(s)->tm_hour)
+#define WSTAMP_MIN(s) (WSTAMP_TM(s)->tm_min)
 
 typedef struct _diskfree_t diskfree_t;
 #define DISKFREE_T_AVAIL(d) d.avail_clusters
@@ -392,6 +395,12 @@ typedef struct ffblk finddata_t;
 #define FINDDATA_T_WDATE_DAY(f) ((f).ff_fdate)&0x1F
 #define FINDDATA_T_WTIME_HOUR(f) ((f).ff_ftime>>11)&0x1F
 #define FINDDATA_T_WTIME_MIN(f) ((f).ff_ftime>>5)&0x3F
+#define FINDDATA_T_WSTAMP(f) (((unsigned long)(f).ff_fdate<<16)|(f).ff_ftime)
+#define WSTAMP_YEAR(s) ((((s)>>25)&0x7F)+1980)
+#define WSTAMP_MON(s) (((s)>>21)&0xF)
+#define WSTAMP_DAY(s) (((s)>>16)&0x1F)
+#define WSTAMP_HOUR(s) (((s)>>11)&0x1F)
+#define WSTAMP_MIN(s) (((s)>>5)&0x3F)
 static inline int findclose_f(long handle);
 static inline int findfirst_f(const char *pathname, finddata_t *ff, int attrib, long *handle)
 {
@@ -18,9 +18,10 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
-#include <glob.h>
 #include <assert.h>
+#include <conio.h>
 #include "command.h"
 #include "cmdbuf.h"
 #include "compl.h"
@@ -37,12 +38,219 @@ struct cmpl_s {
     struct compl_s compls[MAX_COMPLS];
 };
 
-static int cmpstr(const char *s1, const char *s2)
+/* candidate names from several sources, sorted and without dups */
+struct name_list {
+    const char **names;
+    int num;
+    int size;
+};
+
+static int name_cmp(const void *a, const void *b)
+{
+    return strcasecmp(*(const char **)a, *(const char **)b);
+}
+
+static int name_list_add(struct name_list *nl, const char *name)
 {
-    int cnt = 0;
-    while (s1[cnt] && s2[cnt] && s1[cnt] == s2[cnt])
-	cnt++;
-    return cnt;
+    if (nl->num == nl->size) {
+	int size = nl->size ? nl->size * 2 : 64;
+	const char **n = realloc(nl->names, size * sizeof(*n));
+
+	if (!n)
+	    return -1;
+	nl->names = n;
+	nl->size = size;
+    }
+    nl->names[nl->num++] = name;
+    return 0;
+}
+
+/* NUL separated names. Take pointers into it with pool_to_list() once
+ * it is complete, as it moves while growing. */
+struct name_pool {
+    char *buf;
+    size_t len;
+    size_t size;
+};
+
+static int pool_add(struct name_pool *np, const char *name, int is_dir)
+{
+    size_t nlen = strlen(name);
+
+    if (np->len + nlen + 2 > np->size) {
+	size_t size = np->size ? np->size * 2 : 512;
+	char *buf;
+
+	while (np->len + nlen + 2 > size)
+	    size *= 2;
+	buf = realloc(np->buf, size);
+	if (!buf)
+	    return -1;
+	np->buf = buf;
+	np->size = size;
+    }
+    memcpy(np->buf + np->len, name, nlen);
+    np->len += nlen;
+    if (is_dir)
+	np->buf[np->len++] = '\\';
+    np->buf[np->len++] = '\0';
+    return 0;
+}
+
+static int pool_to_list(const struct name_pool *np, struct name_list *nl)
+{
+    size_t off;
+
+    for (off = 0; off < np->len; off += strlen(np->buf + off) + 1) {
+	if (name_list_add(nl, np->buf + off) != 0)
+	    return -1;
+    }
+    return 0;
+}
+
+static const char *base_name(const char *path)
+{
+    const char *p;
+
+    for (p = path + strlen(path); p > path; p--) {
+	if (p[-1] == '\\' || p[-1] == '/' || p[-1] == ':')
+	    break;
+    }
+    return p;
+}
+
+static int is_exec_name(const char *name)
+{
+    const char *ext = strrchr(name, '.');
+
+    if (!ext)
+	return 0;
+    return (strcasecmp(ext, ".bat") == 0 || strcasecmp(ext, ".exe") == 0 ||
+	    strcasecmp(ext, ".com") == 0);
+}
+
+/* Read the names in dir into np in one findfirst/findnext pass. dir
+ * is taken up to len and must end with a separator, or be empty for
+ * the current dir. Dirs are told by the find data and get a trailing
+ * backslash. */
+static int read_dir(const char *dir, int len, int exec_only,
+	struct name_pool *np)
+{
+    char buf[MAXPATH];
+    finddata_t ff;
+    long h;
+    int done;
+
+    snprintf(buf, sizeof(buf), "%.*s*.*", len, dir);
+    done = (findfirst_f(buf, &ff, FA_DIREC | FA_HIDDEN | FA_SYSTEM, &h) != 0);
+    while (!done) {
+	const char *n = FINDDATA_T_FILENAME(ff);
+	int is_dir = ((FINDDATA_T_ATTRIB(ff) & FA_DIREC) != 0);
+
+	if (strcmp(n, ".") != 0 && (!exec_only || (!is_dir && is_exec_name(n)))) {
+	    if (pool_add(np, n, is_dir) != 0) {
+		findclose_f(h);
+		return -1;
+	    }
+	}
+	done = (findnext_f(&ff, h) != 0);
+    }
+    return 0;
+}
+
+/* Listings of the last few dirs completed in, so that listing the
+ * matches and completing several args in one dir read it only once.
+ * They live for one command line: FAT does not update the dir
+ * timestamp when files come and go, so it can't tell whether a listing
+ * is still good across commands, and within a line nothing but the
+ * user's own typing runs. So they are trusted without any check until
+ * the next prompt calls compl_invalidate(). As neither the current dir
+ * nor the drives change within a line, the dir part as typed is a good
+ * enough key. */
+#define DIR_CACHE_SIZE 4
+struct dir_cache {
+    char dir[MAXPATH];
+    unsigned gen;
+    unsigned long used;
+    struct name_pool pool;
+};
+
+static struct dir_cache dir_cache[DIR_CACHE_SIZE];
+static unsigned long dir_cache_clock;
+/* bumped by compl_invalidate() */
+static unsigned compl_gen = 1;
+
+/* Drop what was cached for the previous command line. */
+void compl_invalidate(void)
+{
+    compl_gen++;
+}
+
+static struct name_pool *dir_listing(const char *dir, int len)
+{
+    struct dir_cache *dc = NULL;
+    int i;
+
+    if (len >= MAXPATH)
+	return NULL;
+    for (i = 0; i < DIR_CACHE_SIZE; i++) {
+	struct dir_cache *c = &dir_cache[i];
+
+	if (c->gen == compl_gen && strncasecmp(c->dir, dir, len) == 0 &&
+		c->dir[len] == '\0') {
+	    c->used = ++dir_cache_clock;
+	    return &c->pool;
+	}
+    }
+    /* reuse a slot left from an older line, or the least recently used */
+    for (i = 0; i < DIR_CACHE_SIZE; i++) {
+	struct dir_cache *c = &dir_cache[i];
+
+	if (c->gen != compl_gen) {
+	    dc = c;
+	    break;
+	}
+	if (!dc || c->used < dc->used)
+	    dc = c;
+    }
+
+    free(dc->pool.buf);
+    memset(dc, 0, sizeof(*dc));
+    if (read_dir(dir, len, 0, &dc->pool) != 0) {
+	free(dc->pool.buf);
+	memset(&dc->pool, 0, sizeof(dc->pool));
+	return NULL;
+    }
+    memcpy(dc->dir, dir, len);
+    dc->dir[len] = '\0';
+    dc->gen = compl_gen;
+    dc->used = ++dir_cache_clock;
+    return &dc->pool;
+}
+
+/* Add the entries of the dir part of prefix whose names start with its
+ * name part, ignoring case, to nl. */
+static int scan_dir(const char *prefix, int exec_only, struct name_list *nl)
+{
+    const char *name = base_name(prefix);
+    int len = strlen(name);
+    struct name_pool *np = dir_listing(prefix, name - prefix);
+    size_t off;
+
+    if (!np)
+	return -1;
+    for (off = 0; off < np->len; off += strlen(np->buf + off) + 1) {
+	const char *n = np->buf + off;
+	int is_dir = (n[strlen(n) - 1] == '\\');
+
+	if (strncasecmp(n, name, len) != 0 || (!len && n[0] == '.'))
+	    continue;
+	if (exec_only && (is_dir || !is_exec_name(n)))
+	    continue;
+	if (name_list_add(nl, n) != 0)
+	    return -1;
+    }
+    return 0;
 }
 
 static const char *get_cmd_name(int idx, void *arg)
@@ -52,13 +260,6 @@ static const char *get_cmd_name(int idx, void *arg)
     return cmd[idx].cmd_name;
 }
 
-static const char *get_fname(int idx, void *arg)
-{
-    glob_t *gl = arg;
-    assert(idx < gl->gl_pathc);
-    return gl->gl_pathv[idx];
-}
-
 static const char *get_compl_name(int idx, void *arg)
 {
     struct cmpl_s *cmpl = arg;
@@ -75,100 +276,280 @@ static const char *get_compl_name(int idx, void *arg)
     return NULL;
 }
 
+/* Print the matches sorted, in as many columns as fit the screen. */
+static void print_matches(const char **m, int num)
+{
+    struct text_info txinfo;
+    int i, j, w = 0, cols, rows;
+
+    qsort(m, num, sizeof(*m), name_cmp);
+    for (i = 0; i < num; i++) {
+	int l = strlen(m[i]);
+	if (l > w)
+	    w = l;
+    }
+    w += 2;
+    gettextinfo(&txinfo);
+    cols = (txinfo.screenwidth ? txinfo.screenwidth - 1 : 79) / w;
+    if (cols < 1)
+	cols = 1;
+    rows = (num + cols - 1) / cols;
+    for (i = 0; i < rows; i++) {
+	for (j = i; j < num; j += rows) {
+	    if (j + rows < num)
+		printf("%-*s", w, m[j]);
+	    else
+		printf("%s", m[j]);
+	}
+	putchar('\n');
+    }
+}
+
+/* Find the matches of prefix and their longest common suffix in one
+ * pass: every match is only compared against the first one in place,
+ * narrowing the common length. */
 static int do_compl(const char *prefix, int print, int *r_len,
 		    char *r_p, const char *(*get)(int idx, void *arg),
 		    void *arg, int num)
 {
-    int i, cnt = 0, idx = -1, len = strlen(prefix);
-    char suff[MAX_CMD_BUFLEN] = "";
+    int i, cnt = 0, len = strlen(prefix), common = 0;
+    const char *first = NULL;
+    struct name_list m = { };
 
     for (i = 0; i < num; i++) {
 	const char *c = get(i, arg);
-	/* Note: even though strncasecmp() is used, file-name completions
-	 * are still case-sensitive because the completion candidates are
-	 * added via glob() fn, which is case-sensitive. */
 	if (strncasecmp(prefix, c, len) == 0) {
 	    const char *p = c + len;
-	    int l = cmpstr(p, suff);
 
-	    strcpy(suff, p);
-	    if (cnt)
-		suff[l] = '\0';
+	    if (!first) {
+		first = p;
+		common = strlen(p);
+	    } else {
+		int l = 0;
+
+		while (l < common && p[l] == first[l])
+		    l++;
+		common = l;
+	    }
 	    cnt++;
-	    idx = i;
 	    if (print)
-		puts(c);
+		name_list_add(&m, c);
 	}
     }
+    if (print && m.num)
+	print_matches(m.names, m.num);
+    free(m.names);
     if (cnt == 0)
 	return -1;
-    *r_len = strlen(suff);
-    strcpy(r_p, get(idx, arg) + len);
+    *r_len = common;
+    strcpy(r_p, first);
     if (cnt == 1)
 	return 1;
     return 0;
 }
 
-static void glb_add(struct cmpl_s *cmpl, glob_t *gl)
-{
-    struct compl_s *c = &cmpl->compls[cmpl->num++];
+/* Index of the executables in the PATH dirs. Each dir keeps its names
+ * in a string pool plus a sorted array of pointers into it. The dir
+ * timestamp can't tell that a program was added on FAT, so a dir is
+ * read once and then only when PATH changes, or when the user asks by
+ * pressing Tab twice on a prefix that still matches nothing. */
+struct path_dir {
+    char *dir;
+    int scanned;
+    struct name_pool pool;
+    struct name_list list;
+};
 
-    c->opaque = gl;
-    c->get_name = get_fname;
-    c->num = gl->gl_pathc;
+static char *path_env;
+static struct path_dir *path_dirs;
+static int num_path_dirs;
+static char path_miss[MAXPATH];
+
+static void path_dir_clear(struct path_dir *pd)
+{
+    free(pd->pool.buf);
+    free(pd->list.names);
+    memset(&pd->pool, 0, sizeof(pd->pool));
+    memset(&pd->list, 0, sizeof(pd->list));
+    pd->scanned = 0;
 }
 
-static int glb_fill(glob_t *gl, const char *prefix, const char *suff,
-        const char *ext, struct cmpl_s *cmpl)
+static int path_dir_scan(struct path_dir *pd)
 {
     char buf[MAXPATH];
-    int err, cnt = 0;
 
-    snprintf(buf, MAXPATH, "%s%s%s", prefix, suff, ext);
-    err = glob(buf, GLOB_ERR, NULL, gl);
-    if (err && err != GLOB_NOMATCH)
+    path_dir_clear(pd);
+    snprintf(buf, sizeof(buf), "%s\\", pd->dir);
+    if (read_dir(buf, strlen(buf), 1, &pd->pool) != 0 ||
+	    pool_to_list(&pd->pool, &pd->list) != 0) {
+	path_dir_clear(pd);
 	return -1;
-    if (err) {
-	/* try case-insensitive */
-	strupr(buf);
-	err = glob(buf, GLOB_ERR, NULL, gl);
-	if (err && err != GLOB_NOMATCH)
+    }
+    qsort(pd->list.names, pd->list.num, sizeof(*pd->list.names), name_cmp);
+    pd->scanned = 1;
+    return 0;
+}
+
+/* Re-split PATH if it changed, keeping the dirs that are still there. */
+static int path_idx_update(void)
+{
+    const char *path = getenv("PATH");
+    struct path_dir *dirs;
+    char *copy, *tok;
+    int num = 0, i;
+
+    if (!path)
+	path = "";
+    if (path_env && strcmp(path, path_env) == 0)
+	return 0;
+    copy = strdup(path);
+    if (!copy)
+	return -1;
+    for (tok = copy; *tok; tok++)
+	if (*tok == ';')
+	    num++;
+    dirs = calloc(num + 1, sizeof(*dirs));
+    if (!dirs) {
+	free(copy);
+	return -1;
+    }
+    num = 0;
+    for (tok = strtok(copy, ";"); tok; tok = strtok(NULL, ";")) {
+	size_t len = strlen(tok);
+
+	while (len > 1 && (tok[len - 1] == '\\' || tok[len - 1] == '/'))
+	    tok[--len] = '\0';
+	if (!len)
+	    continue;
+	for (i = 0; i < num_path_dirs; i++) {
+	    if (path_dirs[i].dir && strcasecmp(path_dirs[i].dir, tok) == 0)
+		break;
+	}
+	if (i < num_path_dirs) {
+	    dirs[num] = path_dirs[i];
+	    memset(&path_dirs[i], 0, sizeof(path_dirs[i]));
+	} else {
+	    dirs[num].dir = strdup(tok);
+	    if (!dirs[num].dir)
+		continue;
+	}
+	num++;
+    }
+    for (i = 0; i < num_path_dirs; i++) {
+	free(path_dirs[i].dir);
+	path_dir_clear(&path_dirs[i]);
+    }
+    free(path_dirs);
+    path_dirs = dirs;
+    num_path_dirs = num;
+    /* the dir names were copied out, so keep the original string */
+    strcpy(copy, path);
+    free(path_env);
+    path_env = copy;
+    return 0;
+}
+
+static int path_dir_find(const struct path_dir *pd, const char *prefix,
+	int len)
+{
+    int lo = 0, hi = pd->list.num;
+
+    while (lo < hi) {
+	int mid = (lo + hi) / 2;
+
+	if (strncasecmp(pd->list.names[mid], prefix, len) < 0)
+	    lo = mid + 1;
+	else
+	    hi = mid;
+    }
+    return lo;
+}
+
+/* Append the PATH executables starting with prefix to nl. */
+static int path_idx_match(const char *prefix, struct name_list *nl)
+{
+    int len = strlen(prefix);
+    int i, j;
+
+    if (path_idx_update() != 0)
+	return -1;
+    for (i = 0; i < num_path_dirs; i++) {
+	struct path_dir *pd = &path_dirs[i];
+
+	if (!pd->scanned && path_dir_scan(pd) != 0)
 	    return -1;
+	for (j = path_dir_find(pd, prefix, len); j < pd->list.num &&
+		strncasecmp(pd->list.names[j], prefix, len) == 0; j++) {
+	    if (name_list_add(nl, pd->list.names[j]) != 0)
+		return -1;
+	}
+    }
+    return 0;
+}
+
+/* Called when prefix matched nothing. Returns 1 when it also missed the
+ * last time, after dropping the PATH listings so that they are read
+ * again. */
+static int path_idx_missed(const char *prefix)
+{
+    int i;
+
+    if (strcasecmp(prefix, path_miss) != 0) {
+	snprintf(path_miss, sizeof(path_miss), "%s", prefix);
+	return 0;
     }
-    if (!err) {
-	glb_add(cmpl, gl);
-	cnt += gl->gl_pathc;
+    path_miss[0] = '\0';
+    for (i = 0; i < num_path_dirs; i++)
+	path_dir_clear(&path_dirs[i]);
+    return 1;
+}
+
+static const char *get_list_name(int idx, void *arg)
+{
+    struct name_list *nl = arg;
+    assert(idx < nl->num);
+    return nl->names[idx];
+}
+
+static void name_list_uniq(struct name_list *nl)
+{
+    int i, j;
+
+    if (!nl->num)
+	return;
+    qsort(nl->names, nl->num, sizeof(*nl->names), name_cmp);
+    for (i = 1, j = 1; i < nl->num; i++) {
+	if (strcasecmp(nl->names[i], nl->names[j - 1]) != 0)
+	    nl->names[j++] = nl->names[i];
     }
-    return cnt;
+    nl->num = j;
 }
 
 int compl_cmds(const char *prefix, int print, int *r_len, char *r_p)
 {
     struct cmpl_s cmpl = { };
-    glob_t gl_bat, gl_exe, gl_com;
-    int err, ret = -1, cnt = 0;
-    const char *p;
-    const char *suff = ((p = strchr(prefix, '.')) ? "" : "*.");
+    struct name_list nl = { };
+    int ret = -1, cnt = 0;
+    const char *p = strchr(prefix, '.');
+    const char *name = base_name(prefix);
 
     if (p && p[1] != '\0')
 	return compl_fname(prefix, print, r_len, r_p);
 
-    err = glb_fill(&gl_bat, prefix, suff, "bat", &cmpl);
-    if (err == -1)
-	return -1;
-    cnt += err;
-
-    err = glb_fill(&gl_exe, prefix, suff, "exe", &cmpl);
-    if (err == -1)
-	goto err1;
-    cnt += err;
-
-    err = glb_fill(&gl_com, prefix, suff, "com", &cmpl);
-    if (err == -1)
-	goto err2;
-    cnt += err;
+  again:
+    if (scan_dir(prefix, 1, &nl) != 0)
+	goto out;
+    /* the same program may be both here and on PATH, list it once */
+    if (name == prefix && path_idx_match(prefix, &nl) != 0)
+	goto out;
+    name_list_uniq(&nl);
+    cmpl.compls[cmpl.num].opaque = &nl;
+    cmpl.compls[cmpl.num].get_name = get_list_name;
+    cmpl.compls[cmpl.num].num = nl.num;
+    cmpl.num++;
+    cnt += nl.num;
 
-    if (!p) {
+    if (!p && name == prefix) {
 	cmpl.compls[cmpl.num].opaque = cmd_table;
 	cmpl.compls[cmpl.num].get_name = get_cmd_name;
 	cmpl.compls[cmpl.num].num = CMD_TABLE_COUNT;
@@ -176,35 +557,37 @@ int compl_cmds(const char *prefix, int print, int *r_len, char *r_p)
 	cnt += CMD_TABLE_COUNT;
     }
 
-    ret = do_compl(prefix, print, r_len, r_p, get_compl_name, &cmpl, cnt);
-
-    globfree(&gl_com);
-  err2:
-    globfree(&gl_exe);
-  err1:
-    globfree(&gl_bat);
+    ret = do_compl(name, print, r_len, r_p, get_compl_name, &cmpl, cnt);
+    if (ret == -1 && name == prefix && path_idx_missed(prefix)) {
+	free(nl.names);
+	memset(&nl, 0, sizeof(nl));
+	memset(&cmpl, 0, sizeof(cmpl));
+	cnt = 0;
+	goto again;
+    }
 
+  out:
+    free(nl.names);
     return ret;
 }
 
+/* A unique match that is a dir is completed with its backslash, but
+ * returned as ambiguous so that no space gets added after it. */
 int compl_fname(const char *prefix, int print, int *r_len, char *r_p)
 {
-    char buf[MAXPATH];
-    glob_t gl;
-    int err, ret;
-
-    snprintf(buf, MAXPATH, "%s*", prefix);
-    err = glob(buf, GLOB_ERR, NULL, &gl);
-    if (err) {
-	/* Try simplest case-insensitive match against all-upcased.
-	 * There can be quake and Quake and QuAkE dirs simultaneously
-	 * and we aren't going to iterate those. */
-	strupr(buf);
-	err = glob(buf, GLOB_ERR, NULL, &gl);
-    }
-    if (err)
-	return -1;
-    ret = do_compl(prefix, print, r_len, r_p, get_fname, &gl, gl.gl_pathc);
-    globfree(&gl);
+    struct name_list nl = { };
+    int ret = -1;
+
+    if (scan_dir(prefix, 0, &nl) != 0)
+	goto out;
+    ret = do_compl(base_name(prefix), print, r_len, r_p, get_list_name,
+	    &nl, nl.num);
+    if (ret == 1 && r_p[0] && r_p[strlen(r_p) - 1] == '\\') {
+	*r_len = strlen(r_p);
+	ret = 0;
+    }
+
+  out:
+    free(nl.names);
     return ret;
 }
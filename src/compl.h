@@ -3,5 +3,6 @@
 
 int compl_cmds(const char *prefix, int print, int *r_len, char *r_p);
 int compl_fname(const char *prefix, int print, int *r_len, char *r_p);
+void compl_invalidate(void);
 
 #endif
@@ -0,0 +1,78 @@
+/*
+ *  comcom64 - 64bit command.com
+ *  crc32.c: table-driven CRC32 (slicing-by-8)
+ *  Copyright (C) 2026  @stsp
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdint.h>
+#include <string.h>
+#include "crc32.h"
+
+#define CRC32_POLY 0xedb88320u
+
+static uint32_t crc_tab[8][256];
+static int crc_inited;
+
+static void crc32_init(void)
+{
+  int i, t, k;
+
+  for (i = 0; i < 256; i++)
+    {
+    uint32_t c = i;
+    for (k = 0; k < 8; k++)
+      c = (c & 1) ? CRC32_POLY ^ (c >> 1) : c >> 1;
+    crc_tab[0][i] = c;
+    }
+  for (i = 0; i < 256; i++)
+    {
+    for (t = 1; t < 8; t++)
+      crc_tab[t][i] = (crc_tab[t - 1][i] >> 8) ^
+          crc_tab[0][crc_tab[t - 1][i] & 0xff];
+    }
+  crc_inited = 1;
+}
+
+/* x86 only: the 8-byte step relies on little-endian loads */
+uint32_t crc32_update(uint32_t crc, const void *buf, unsigned len)
+{
+  const unsigned char *p = buf;
+
+  if (!crc_inited)
+    crc32_init();
+  crc = ~crc;
+  while (len && ((uintptr_t)p & 3))
+    {
+    crc = crc_tab[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+    len--;
+    }
+  while (len >= 8)
+    {
+    uint32_t lo, hi;
+    memcpy(&lo, p, 4);
+    memcpy(&hi, p + 4, 4);
+    lo ^= crc;
+    crc = crc_tab[7][lo & 0xff] ^ crc_tab[6][(lo >> 8) & 0xff] ^
+        crc_tab[5][(lo >> 16) & 0xff] ^ crc_tab[4][lo >> 24] ^
+        crc_tab[3][hi & 0xff] ^ crc_tab[2][(hi >> 8) & 0xff] ^
+        crc_tab[1][(hi >> 16) & 0xff] ^ crc_tab[0][hi >> 24];
+    p += 8;
+    len -= 8;
+    }
+  while (len--)
+    crc = crc_tab[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+  return ~crc;
+}
@@ -48,6 +48,11 @@ static __dpmi_raddr new_int21;
 static __dpmi_raddr term_cb;
 static int int21_hooked;
 static int term_hooked;
+/* While a program runs with djterm enabled, the tty stays in the
+ * adjusted state between writes and is restored on djterm_disable(). */
+static int term_keep;
+static int term_adjusted;
+static struct termios saved_term;
 
 static unsigned short popw(__dpmi_regs *r)
 {
@@ -76,16 +81,33 @@ static void do_ljmp(__dpmi_regs *r, __dpmi_raddr addr)
   r->x.cs = addr.segment;
 }
 
-static int term_write(unsigned addr, int len)
+static void term_adjust(void)
 {
-  static char buf[1024];  // static because of small stack
-  struct termios term, old_term;
-  int done = 0;
+  struct termios term;
 
-  tcgetattr(STDOUT_FILENO, &old_term);
-  term = old_term;
+  if (term_adjusted)
+    return;
+  tcgetattr(STDOUT_FILENO, &saved_term);
+  term = saved_term;
   term.c_oflag &= ~(ONLCR | OCRNL);
   tcsetattr(STDOUT_FILENO, TCSADRAIN, &term);
+  term_adjusted = 1;
+}
+
+static void term_restore(void)
+{
+  if (!term_adjusted)
+    return;
+  tcsetattr(STDOUT_FILENO, TCSADRAIN, &saved_term);
+  term_adjusted = 0;
+}
+
+static int term_write(unsigned addr, int len)
+{
+  static char buf[16384];  // static because of small stack
+  int done = 0;
+
+  term_adjust();
   while (len)
     {
     int todo = _min(sizeof(buf), len);
@@ -94,7 +116,8 @@ static int term_write(unsigned addr, int len)
     len -= todo;
     done += todo;
     }
-  tcsetattr(STDOUT_FILENO, TCSADRAIN, &old_term);
+  if (!term_keep)
+    term_restore();
   return done;
 }
 
@@ -110,17 +133,18 @@ void do_int21(void)
 #else
   _r = *int21_regs;
 #endif
+  /* our own int21 calls must not come back here */
   if (r->h.ah == 0x40 && r->x.bx == STDOUT_FILENO)
     {
-    djterm_disable();
+    int21_enabled = 0;
     proceed = isatty(STDOUT_FILENO);
-    djterm_enable();
+    int21_enabled = 1;
     }
   if (proceed)
     {
-    djterm_disable();
+    int21_enabled = 0;
     r->x.ax = term_write((r->x.ds << 4) + r->x.dx, r->x.cx);
-    djterm_enable();
+    int21_enabled = 1;
     do_iret(r, ~CF);
     }
   else
@@ -246,14 +270,19 @@ void djterm_done(void)
     }
   int21_hooked = 0;
   term_hooked = 0;
+  term_keep = 0;
+  term_restore();
 }
 
 void djterm_enable(void)
 {
   int21_enabled = 1;
+  term_keep = 1;
 }
 
 void djterm_disable(void)
 {
   int21_enabled = 0;
+  term_keep = 0;
+  term_restore();
 }
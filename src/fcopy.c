@@ -0,0 +1,205 @@
+/*
+ *  comcom64 - 64bit command.com
+ *  fcopy.c: file copy engine working through a DOS memory buffer
+ *  Copyright (C) 2026  @stsp
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <dpmi.h>
+#include <go32.h>
+#include <sys/movedata.h>
+#include "crc32.h"
+#include "fcopy.h"
+
+#define CF 1
+/* 65520 bytes is the most a single int21 read/write can move */
+#define FCOPY_MAX_PARAS 0xfff
+#define FCOPY_MIN_PARAS 0x100
+
+static int buf_sel;
+static unsigned short buf_seg;
+static unsigned buf_size;
+/* protected mode copy of the chunk, only needed for checksumming */
+static char *pm_buf;
+static fcopy_progress_t progress;
+
+/* Allocate the bounce buffer in conventional memory. If there is not
+ * enough of it, fcopy_fd() falls back to the transfer buffer. */
+int fcopy_buf_alloc(void)
+{
+  int paras;
+
+  if (buf_sel)
+    return 0;
+  for (paras = FCOPY_MAX_PARAS; paras >= FCOPY_MIN_PARAS; paras >>= 1)
+    {
+    int seg = __dpmi_allocate_dos_memory(paras, &buf_sel);
+    if (seg != -1)
+      {
+      buf_seg = seg;
+      buf_size = paras << 4;
+      return 0;
+      }
+    }
+  buf_sel = 0;
+  return -1;
+}
+
+void fcopy_buf_free(void)
+{
+  free(pm_buf);
+  pm_buf = NULL;
+  if (!buf_sel)
+    return;
+  __dpmi_free_dos_memory(buf_sel);
+  buf_sel = 0;
+  buf_seg = 0;
+  buf_size = 0;
+}
+
+static unsigned get_buf(unsigned short *seg, unsigned short *off, int need_pm)
+{
+  unsigned chunk;
+
+  if (buf_sel)
+    {
+    *seg = buf_seg;
+    *off = 0;
+    chunk = buf_size;
+    }
+  else
+    {
+    *seg = __tb_segment;
+    *off = __tb_offset;
+    chunk = __tb_size;
+    /* a 64K transfer buffer would make CX wrap to 0 */
+    if (chunk > FCOPY_MAX_PARAS << 4)
+      chunk = FCOPY_MAX_PARAS << 4;
+    }
+  if (need_pm && !pm_buf)
+    {
+    /* sized for the largest chunk, as the DOS buffer may come later */
+    pm_buf = malloc(FCOPY_MAX_PARAS << 4);
+    if (!pm_buf)
+      return 0;
+    }
+  return chunk;
+}
+
+static int dos_rw(int ah, int fd, unsigned short seg, unsigned short off,
+    unsigned len)
+{
+  __dpmi_regs r = {};
+
+  r.h.ah = ah;
+  r.x.bx = fd;
+  r.x.cx = len;
+  r.x.ds = seg;
+  r.x.dx = off;
+  __dpmi_int(0x21, &r);
+  if (r.x.flags & CF)
+    return -1;
+  return r.x.ax;
+}
+
+/* Writing 0 bytes truncates or extends the file to the current position. */
+static int dos_set_size(int fd, long size)
+{
+  if (lseek(fd, size, SEEK_SET) == -1)
+    return -1;
+  return dos_rw(0x40, fd, 0, 0, 0);
+}
+
+/* Copy src_fd to dst_fd, starting at their current positions.
+ * The data goes from one handle to another through DOS memory and is
+ * never copied to our address space, unless crc is requested. If size
+ * is known, the destination is extended to it first so that DOS can
+ * allocate it in one go. */
+int fcopy_fd(int dst_fd, int src_fd, unsigned long size, uint32_t *crc)
+{
+  unsigned short seg, off;
+  unsigned chunk;
+  unsigned long done = 0;
+  long start = -1;
+
+  chunk = get_buf(&seg, &off, !!crc);
+  if (!chunk)
+    return -1;
+
+  if (size)
+    {
+    start = lseek(dst_fd, 0, SEEK_CUR);
+    if (start == -1 || dos_set_size(dst_fd, start + size) == -1)
+      return -1;
+    if (lseek(dst_fd, start, SEEK_SET) == -1)
+      return -1;
+    }
+
+  for (;;)
+    {
+    int rd, wr;
+
+    rd = dos_rw(0x3f, src_fd, seg, off, chunk);
+    if (rd == -1)
+      return -1;
+    if (rd == 0)
+      break;
+    wr = dos_rw(0x40, dst_fd, seg, off, rd);
+    if (wr != rd)
+      return -1;
+    if (crc)
+      {
+      dosmemget((seg << 4) + off, rd, pm_buf);
+      *crc = crc32_update(*crc, pm_buf, rd);
+      }
+    done += rd;
+    if (progress)
+      progress(done, size);
+    }
+
+  /* source got shorter than expected - drop the pre-allocated tail */
+  if (start != -1 && done < size)
+    {
+    if (dos_set_size(dst_fd, start + done) == -1)
+      return -1;
+    }
+  return 0;
+}
+
+/* Have cb called after every chunk copied by fcopy_fd(). */
+void fcopy_set_progress(fcopy_progress_t cb)
+{
+  progress = cb;
+}
+
+/* Checksum the rest of fd, reading it through the same buffer. */
+int fcopy_crc(int fd, uint32_t *crc)
+{
+  unsigned short seg, off;
+  unsigned chunk;
+  int rd;
+
+  chunk = get_buf(&seg, &off, 1);
+  if (!chunk)
+    return -1;
+  while ((rd = dos_rw(0x3f, fd, seg, off, chunk)) > 0)
+    {
+    dosmemget((seg << 4) + off, rd, pm_buf);
+    *crc = crc32_update(*crc, pm_buf, rd);
+    }
+  return rd;
+}
@@ -0,0 +1,14 @@
+#ifndef FCOPY_H
+#define FCOPY_H
+
+#include <stdint.h>
+
+typedef void (*fcopy_progress_t)(unsigned long done, unsigned long size);
+
+int fcopy_buf_alloc(void);
+void fcopy_buf_free(void);
+int fcopy_fd(int dst_fd, int src_fd, unsigned long size, uint32_t *crc);
+int fcopy_crc(int fd, uint32_t *crc);
+void fcopy_set_progress(fcopy_progress_t cb);
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ *  comcom64 - 64bit command.com
+ *  walk.c: directory tree walker
+ *  Copyright (C) 2026  @stsp
+ *
+ *  This program is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "command.h"
+#include "walk.h"
+
+/* Replace everything past len in path with tail. */
+int set_path_tail(char *path, size_t len, const char *tail)
+{
+  size_t tlen = strlen(tail);
+
+  if (len + tlen >= MAXPATH)
+    return -1;
+  memcpy(path + len, tail, tlen + 1);
+  return 0;
+}
+
+void walk_init(struct walk *w, const char *spec)
+{
+  memset(w, 0, sizeof(*w));
+  w->spec = spec;
+}
+
+void walk_done(struct walk *w)
+{
+  free(w->names);
+  w->names = NULL;
+  w->names_len = 0;
+  w->names_size = 0;
+}
+
+/* Names are kept as a stack: each level appends the names of its
+ * subdirs and cuts them off when done. Refer to them by offset, the
+ * buffer moves when it grows. */
+static int add_name(struct walk *w, const char *name)
+{
+  size_t nlen = strlen(name) + 1;
+
+  if (w->names_len + nlen > w->names_size)
+    {
+    size_t size = w->names_size ? w->names_size * 2 : 1024;
+    char *buf;
+
+    while (w->names_len + nlen > size)
+      size *= 2;
+    buf = realloc(w->names, size);
+    if (!buf)
+      return -1;
+    w->names = buf;
+    w->names_size = size;
+    }
+  memcpy(w->names + w->names_len, name, nlen);
+  w->names_len += nlen;
+  return 0;
+}
+
+static int path_too_long(struct walk *w)
+{
+  w->path[w->len] = '\0';
+  cprintf("Path too long - %s\r\n", w->path);
+  return -1;
+}
+
+static int walk_files(struct walk *w)
+{
+  const char *spec = w->spec;
+  finddata_t ff, cur;
+  long h;
+  int done;
+
+  if (w->level > 0 && w->sub_spec)
+    spec = w->sub_spec;
+  if (set_path_tail(w->path, w->len, spec) != 0)
+    return path_too_long(w);
+  w->dos_calls++;
+  done = (findfirst_f(w->path, &ff, w->attrib, &h) != 0);
+  while (!done)
+    {
+    /* step ahead before the callback, it may delete the file */
+    cur = ff;
+    w->dos_calls++;
+    done = (findnext_f(&ff, h) != 0);
+
+    if ((FINDDATA_T_ATTRIB(cur) & FA_DIREC) != 0)
+      continue;
+    if ((FINDDATA_T_ATTRIB(cur) & w->attr_mask) != w->attr_val)
+      {
+      w->filtered++;
+      continue;
+      }
+    if (set_path_tail(w->path, w->len, FINDDATA_T_FILENAME(cur)) != 0)
+      {
+      if (!done)
+        findclose_f(h);
+      return path_too_long(w);
+      }
+    w->files++;
+    if (w->file(w, &cur) != 0)
+      {
+      if (!done)
+        findclose_f(h);
+      return -1;
+      }
+    }
+  return 0;
+}
+
+/* Take a snapshot of the subdir names, so that the search is finished
+ * before descending. Restarting it on every backtrack would make wide
+ * trees quadratic, and keeping it open would hold an LFN find handle
+ * per level. */
+static int list_dirs(struct walk *w)
+{
+  const char *spec = "*.*";
+  finddata_t ff;
+  long h;
+  int done;
+
+  if (w->level == 0 && w->top_dirs_by_spec)
+    spec = w->spec;
+  if (set_path_tail(w->path, w->len, spec) != 0)
+    return path_too_long(w);
+  w->dos_calls++;
+  done = (findfirst_f(w->path, &ff,
+      FA_DIREC | FA_HIDDEN | FA_SYSTEM | w->attrib, &h) != 0);
+  while (!done)
+    {
+    const char *name = FINDDATA_T_FILENAME(ff);
+
+    if ((FINDDATA_T_ATTRIB(ff) & FA_DIREC) != 0 &&
+        strcmp(name, ".") != 0 && strcmp(name, "..") != 0)
+      {
+      if (add_name(w, name) != 0)
+        {
+        findclose_f(h);
+        cputs("Insufficient memory\r\n");
+        return -1;
+        }
+      }
+    w->dos_calls++;
+    done = (findnext_f(&ff, h) != 0);
+    }
+  return 0;
+}
+
+static int walk_dir(struct walk *w)
+{
+  size_t len = w->len, mark, end, off;
+  int rc;
+
+  if (w->file && walk_files(w) != 0)
+    return -1;
+  if (!w->recurse)
+    return 0;
+
+  mark = w->names_len;
+  if (list_dirs(w) != 0)
+    return -1;
+  end = w->names_len;
+  for (off = mark; off < end; off += strlen(w->names + off) + 1)
+    {
+    size_t sublen = len + strlen(w->names + off) + 1;
+
+    if (set_path_tail(w->path, len, w->names + off) != 0)
+      return path_too_long(w);
+    if (w->dir_pre)
+      {
+      rc = w->dir_pre(w, w->names + off);
+      if (rc == WALK_SKIP)
+        continue;
+      if (rc != 0)
+        return -1;
+      }
+    if (set_path_tail(w->path, sublen - 1, "\\") != 0)
+      return path_too_long(w);
+    w->dirs++;
+    w->len = sublen;
+    w->level++;
+    rc = walk_dir(w);
+    w->level--;
+    w->len = len;
+    if (rc != 0)
+      return -1;
+    if (w->dir_post)
+      {
+      w->path[sublen - 1] = '\0';
+      if (w->dir_post(w, w->names + off) != 0)
+        return -1;
+      }
+    }
+  w->names_len = mark;
+  return 0;
+}
+
+/* Walk dir, which must end with a backslash. Callbacks see the full
+ * path of the file or subdir in w->path. */
+int walk_tree(struct walk *w, const char *dir)
+{
+  w->len = strlen(dir);
+  if (w->len >= MAXPATH)
+    {
+    cprintf("Path too long - %s\r\n", dir);
+    return -1;
+    }
+  memcpy(w->path, dir, w->len + 1);
+  w->level = 0;
+  w->names_len = 0;
+  return walk_dir(w);
+}
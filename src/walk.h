@@ -0,0 +1,51 @@
+#ifndef WALK_H
+#define WALK_H
+
+/* needs command.h for finddata_t */
+
+#define WALK_SKIP 1
+
+struct walk;
+/* Return 0 to go on, -1 to abort the walk. dir_pre may also return
+ * WALK_SKIP to not descend into that dir. */
+typedef int (*walk_file_fn)(struct walk *w, finddata_t *ff);
+typedef int (*walk_dir_fn)(struct walk *w, const char *name);
+
+struct walk
+{
+  /* set up by the caller after walk_init() */
+  const char *spec;       /* files to visit in the top dir */
+  const char *sub_spec;   /* files to visit below it, NULL for spec */
+  int top_dirs_by_spec;   /* top level subdirs must match spec too */
+  int recurse;
+  unsigned attrib;        /* FA_* bits to find besides normal files */
+  unsigned attr_mask;     /* visit only files with */
+  unsigned attr_val;      /* (attrib & attr_mask) == attr_val */
+  walk_file_fn file;
+  walk_dir_fn dir_pre;
+  walk_dir_fn dir_post;
+  void *arg;
+
+  /* path of the current entry; path[0..len) is its dir with a
+   * trailing backslash, the name is appended past it */
+  char path[MAXPATH];
+  size_t len;
+  int level;
+
+  unsigned long dirs;
+  unsigned long files;
+  unsigned long filtered;
+  unsigned long dos_calls;
+
+  /* subdir names of all levels being walked */
+  char *names;
+  size_t names_len;
+  size_t names_size;
+};
+
+void walk_init(struct walk *w, const char *spec);
+int walk_tree(struct walk *w, const char *dir);
+void walk_done(struct walk *w);
+int set_path_tail(char *path, size_t len, const char *tail);
+
+#endif